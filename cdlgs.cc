@@ -18,10 +18,14 @@ MessageBox::MessageBox (Msg::Link l)
 {
 }
 
-void MessageBox::MessageBox_ask (const string_view& prompt, Type type, uint16_t)
+void MessageBox::MessageBox_ask (const string_view& prompt, Type type, windowid_t parent)
 {
     _prompt = prompt;
     _type = type;
+    if (parent) {
+	window_info().set_type (WindowInfo::Type::Dialog);
+	window_info().set_parent (parent);
+    }
     destroy_widgets();
 
     // Each type of box has different number of buttons, which are last
@@ -15,19 +15,21 @@ class IMessageBox : public Interface {
 public:
     enum class Answer : uint16_t { Cancel, Ok, Ignore, Yes = Ok, Retry = Ok, No = Ignore };
     enum class Type : uint16_t { Ok, OkCancel, YesNo, YesNoCancel, RetryCancelIgnore };
+    using windowid_t = WindowInfo::windowid_t;
 public:
     explicit	IMessageBox (mrid_t caller) : Interface (caller) {}
-    void	ask (const string& prompt, Type type = Type()) const
-		    { send (m_ask(), type, uint16_t(0), prompt); }
+    // The box is shown over the parent window, if given
+    void	ask (const string& prompt, Type type = Type(), windowid_t parent = 0) const
+		    { send (m_ask(), type, parent, prompt); }
     template <typename O>
     inline static constexpr bool dispatch (O* o, const Msg& msg) {
 	if (msg.method() != m_ask())
 	    return false;
 	auto is = msg.read();
 	auto type = is.read<Type>();
-	auto flags = is.read<uint16_t>();
+	auto parent = is.read<windowid_t>();
 	auto prompt = is.read<string_view>();
-	o->MessageBox_ask (prompt, type, flags);
+	o->MessageBox_ask (prompt, type, parent);
 	return true;
     }
 public:
@@ -50,10 +52,11 @@ public:
 class MessageBox : public Window {
     using Type = IMessageBox::Type;
     using Answer = IMessageBox::Answer;
+    using windowid_t = IMessageBox::windowid_t;
     IMPLEMENT_INTERFACES_I (Window, (IMessageBox),)
 public:
     explicit		MessageBox (Msg::Link l);
-    inline void		MessageBox_ask (const string_view& prompt, Type type, uint16_t flags);
+    inline void		MessageBox_ask (const string_view& prompt, Type type, windowid_t parent);
     void		on_key (key_t key) override;
 private:
     void		done (Answer answer);
@@ -29,6 +29,13 @@ void Button::on_set_text (void)
     set_size_hints (strlen("[ ") + th.w + strlen (" ]"), th.h);
 }
 
+// A click is a press of Enter, sent to the window from this button
+void Button::on_pointer (const Event& ev)
+{
+    if (ev.type() == Event::Type::ButtonUp && (ev.mods() & (KMod::Left >> KMod::FirstBit)))
+	Widget::on_key (Key::Enter);
+}
+
 DEFINE_WIDGET_WRITE_DRAWLIST (Button, Drawlist, drw)
 {
     if (focused())
@@ -64,6 +71,12 @@ void Checkbox::on_key (key_t k)
     }
 }
 
+void Checkbox::on_pointer (const Event& ev)
+{
+    if (ev.type() == Event::Type::ButtonDown && (ev.mods() & (KMod::Left >> KMod::FirstBit)))
+	on_key (Key::Space);
+}
+
 DEFINE_WIDGET_WRITE_DRAWLIST (Checkbox, Drawlist, drw)
 {
     if (focused())
@@ -113,7 +126,7 @@ void Editbox::posclip (void)
 void Editbox::on_set_text (void)
 {
     Widget::on_set_text();
-    _cpos = text().size();
+    _cpos = min (unsigned(text().size()), unsigned(MaxTextSize));
     _fc = 0;
     posclip();
 }
@@ -134,9 +147,11 @@ void Editbox::on_key (key_t k)
 	    textw().erase (text().iat(--_cpos));
 	else if (k == Key::Delete && _cpos < coord_t (text().size()))
 	    textw().erase (text().iat(_cpos));
-	else if ((k >= ' ' && k <= '~') || (k > Key::Last && k == (k & Key::Mask)))
+	else if ((k >= ' ' && k <= '~') || (k > Key::Last && k == (k & Key::Mask))) {
+	    if (text().size()+4 > MaxTextSize)
+		return;	// full, for a char of up to 4 bytes
 	    textw().insert (text().iat(_cpos++), k);
-	else
+	} else
 	    return Widget::on_key (k);
 	report_modified();
     }
@@ -147,6 +162,26 @@ void Editbox::on_key (key_t k)
     }
 }
 
+void Editbox::on_paste (const string_view& t)
+{
+    // Only the first line is pasted, since an edit box has one line,
+    // and only as much of it as fits, without splitting a UTF-8 char.
+    auto n = 0u, maxn = MaxTextSize - min (unsigned(text().size()), unsigned(MaxTextSize));
+    while (n < t.size() && n < maxn && uint8_t(t[n]) >= ' ')
+	++n;
+    if (n == maxn)
+	while (n && n < t.size() && (uint8_t(t[n]) & 0xc0) == 0x80)
+	    --n;
+    if (!n)
+	return;
+    textw().insert (text().iat(_cpos), t.data(), n);
+    _cpos += n;
+    report_modified();
+    posclip();
+    set_selection (_cpos);
+    report_selection();
+}
+
 DEFINE_WIDGET_WRITE_DRAWLIST (Editbox, Drawlist, drw)
 {
     drw.panel (area().size(), focused() ? PanelType::FocusedEditbox : PanelType::Editbox);
@@ -192,6 +227,18 @@ void Selbox::on_key (key_t k)
     report_selection();
 }
 
+void Selbox::on_repeated_key (key_t k, unsigned n)
+{
+    // Moves by n in one step, reporting the selection once
+    if ((k == 'h' || k == Key::Left) && selection_start())
+	set_selection (selection_start() - min (n, unsigned(selection_start())));
+    else if ((k == 'l' || k == Key::Right) && selection_start()+1 < _n)
+	set_selection (min (selection_start()+n, _n-1u));
+    else
+	return Widget::on_repeated_key (k, n);
+    report_selection();
+}
+
 DEFINE_WIDGET_WRITE_DRAWLIST (Selbox, Drawlist, drw)
 {
     if (focused())
@@ -239,6 +286,29 @@ void Listbox::on_key (key_t k)
     report_selection();
 }
 
+void Listbox::on_repeated_key (key_t k, unsigned n)
+{
+    // Moves by n rows in one step, reporting the selection once
+    if ((k == 'k' || k == Key::Up) && selection_start())
+	set_selection (selection_start() - min (n, unsigned(selection_start())));
+    else if ((k == 'j' || k == Key::Down) && selection_start()+1 < _n)
+	set_selection (min (selection_start()+n, _n-1u));
+    else
+	return Widget::on_repeated_key (k, n);
+    report_selection();
+}
+
+// Clicking a row selects it
+void Listbox::on_pointer (const Event& ev)
+{
+    if (ev.type() != Event::Type::ButtonDown || !(ev.mods() & (KMod::Left >> KMod::FirstBit)))
+	return;
+    if (unsigned row = _top + ev.loc().y - area().y; row < _n && row != selection_start()) {
+	set_selection (row);
+	report_selection();
+    }
+}
+
 DEFINE_WIDGET_WRITE_DRAWLIST (Listbox, Drawlist, drw)
 {
     if (area().w < 1)
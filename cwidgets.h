@@ -25,6 +25,7 @@ class Button : public Widget {
 public:
 		Button (Window* w, const Layout& lay)
 			: Widget(w,lay) { set_flag (f_CanFocus); }
+    void	on_pointer (const Event& ev) override;
 protected:
     void	on_set_text (void) override;
 private:
@@ -38,6 +39,7 @@ public:
 		Checkbox (Window* w, const Layout& lay)
 			: Widget(w,lay) { set_flag (f_CanFocus); }
     void	on_key (key_t k) override;
+    void	on_pointer (const Event& ev) override;
 protected:
     void	on_set_text (void) override;
 private:
@@ -47,9 +49,13 @@ private:
 //{{{ Editbox
 
 class Editbox : public Widget {
+public:
+    // The cursor position is a coord_t, limiting the text length
+    enum { MaxTextSize = INT16_MAX };
 public:
 		Editbox (Window* w, const Layout& lay);
     void	on_key (key_t k) override;
+    void	on_paste (const string_view& t) override;
     void	on_resize (void) override;
 protected:
     void	on_set_text (void) override;
@@ -69,6 +75,7 @@ public:
 		Selbox (Window* w, const Layout& lay)
 		    : Widget(w,lay),_n() { set_flag (f_CanFocus); }
     void	on_key (key_t k) override;
+    void	on_repeated_key (key_t k, unsigned n) override;
 protected:
     void	on_set_text (void) override;
 private:
@@ -87,6 +94,8 @@ public:
 		Listbox (Window* w, const Layout& lay)
 		    : Widget(w,lay),_n(),_top() { set_flag (f_CanFocus); }
     void	on_key (key_t k) override;
+    void	on_repeated_key (key_t k, unsigned n) override;
+    void	on_pointer (const Event& ev) override;
 protected:
     void	on_set_text (void) override;
 private:
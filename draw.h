@@ -4,7 +4,7 @@
 // This file is free software, distributed under the ISC License.
 
 #pragma once
-#include "uidefs.h"
+#include "textwidth.h"
 
 namespace cwiclui {
 
@@ -288,7 +288,7 @@ public:
     private:
 	inline constexpr void	write (Cmd cmd, uint8_t a1 = 0) { Drawlist::Writer<Stm>::write (Drawlist::Cmd(cmd), 0, a1); }
 	template <typename... Arg>
-	inline constexpr void	write (Cmd cmd, uint8_t a1, const Arg&... args) { Drawlist::Writer<Stm>::write (Drawlist::Cmd(cmd), a1, forward<Arg>(args)...); }
+	inline constexpr void	write (Cmd cmd, uint8_t a1, const Arg&... args) { Drawlist::Writer<Stm>::write (Drawlist::Cmd(cmd), a1, args...); }
     public:
 				using Drawlist::Writer<Stm>::line;
 	inline constexpr void	define_color (icolor_t c, color_t rgb)	{ write (Cmd::DefineColor, c, rgb); }
@@ -0,0 +1,816 @@
+// This file is part of the cwiclui project
+//
+// Copyright (c) 2021 by Mike Sharov <msharov@users.sourceforge.net>
+// This file is free software, distributed under the ISC License.
+
+#include "rastscr.h"
+#include <fcntl.h>
+#if __x86_64__ || __i386__
+    #include <immintrin.h>
+#endif
+
+namespace cwiclui {
+
+//{{{ Statics ----------------------------------------------------------
+
+using pixel_t = RasterScreen::pixel_t;
+
+enum { c_DefaultW = 640, c_DefaultH = 480 };
+
+// ASCII from ' ' to '~', 3x5 pixels each, rows top first, in the low
+// 15 bits with the top left pixel highest. Lowercase is drawn as upper.
+static constexpr const uint16_t c_Font3x5 [0x7f-' '] = {
+    0x0000, 0x2482, 0x5a00, 0x5f7d, 0x3c9e, 0x52a5, 0x2aab, 0x2400,
+    0x1491, 0x4494, 0x0aa8, 0x05d0, 0x0014, 0x01c0, 0x0002, 0x12a4,
+    0x7b6f, 0x2c97, 0x73e7, 0x72cf, 0x5bc9, 0x79cf, 0x79ef, 0x7292,
+    0x7bef, 0x7bcf, 0x0410, 0x0414, 0x1511, 0x0e38, 0x4454, 0x7282,
+    0x2b63, 0x2bed, 0x6bae, 0x3923, 0x6b6e, 0x79a7, 0x79a4, 0x396b,
+    0x5bed, 0x7497, 0x126a, 0x5bad, 0x4927, 0x5fed, 0x6b6d, 0x2b6a,
+    0x6ba4, 0x2b73, 0x6bad, 0x388e, 0x7492, 0x5b6f, 0x5b6a, 0x5bfd,
+    0x5aad, 0x5a92, 0x72a7, 0x3493, 0x4889, 0x6496, 0x2a00, 0x0007,
+    0x4400, 0x2bed, 0x6bae, 0x3923, 0x6b6e, 0x79a7, 0x79a4, 0x396b,
+    0x5bed, 0x7497, 0x126a, 0x5bad, 0x4927, 0x5fed, 0x6b6d, 0x2b6a,
+    0x6ba4, 0x2b73, 0x6bad, 0x388e, 0x7492, 0x5b6f, 0x5b6a, 0x5bfd,
+    0x5aad, 0x5a92, 0x72a7, 0x3513, 0x2492, 0x6456, 0x0780
+};
+enum { c_FontW = 3, c_FontH = 5, c_FontScale = 2 };
+
+//}}}-------------------------------------------------------------------
+//{{{ Span fills
+
+static void fill_span_scalar (pixel_t* p, dim_t n, pixel_t c)
+{
+    for (dim_t i = 0; i < n; ++i)
+	p[i] = c;
+}
+
+#if __x86_64__ || __i386__
+
+__attribute__((target("sse2")))
+static void fill_span_sse2 (pixel_t* p, dim_t n, pixel_t c)
+{
+    auto v = _mm_set1_epi32 (c);
+    dim_t i = 0;
+    for (; i+8u <= n; i += 8) {
+	_mm_storeu_si128 ((__m128i*) &p[i], v);
+	_mm_storeu_si128 ((__m128i*) &p[i+4], v);
+    }
+    fill_span_scalar (p+i, n-i, c);
+}
+
+__attribute__((target("avx2")))
+static void fill_span_avx2 (pixel_t* p, dim_t n, pixel_t c)
+{
+    auto v = _mm256_set1_epi32 (c);
+    dim_t i = 0;
+    for (; i+16u <= n; i += 16) {
+	_mm256_storeu_si256 ((__m256i*) &p[i], v);
+	_mm256_storeu_si256 ((__m256i*) &p[i+8], v);
+    }
+    fill_span_scalar (p+i, n-i, c);
+}
+
+#endif
+
+using fill_span_fn_t = void (*)(pixel_t* p, dim_t n, pixel_t c);
+
+// Picks the widest vector unit available on this CPU
+static fill_span_fn_t select_fill_span (void)
+{
+#if __x86_64__ || __i386__
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports ("avx2"))
+	return fill_span_avx2;
+    if (__builtin_cpu_supports ("sse2"))
+	return fill_span_sse2;
+#endif
+    return fill_span_scalar;
+}
+static const auto s_fill_span = select_fill_span();
+
+void RasterScreen::Canvas::fill_span (pixel_t* p, dim_t n, pixel_t c)
+    { s_fill_span (p, n, c); }
+
+//}}}-------------------------------------------------------------------
+//{{{ Canvas
+
+void RasterScreen::Canvas::resize (const Size& sz)
+{
+    _size = sz;
+    _pixels.resize (sz.w*sz.h);
+}
+
+void RasterScreen::Canvas::fill (const Rect& r, pixel_t c)
+{
+    auto cr = Rect (_size).clip (r);
+    if (cr.empty())
+	return;
+    for (auto y = cr.y; y < cr.y+cr.h; ++y)
+	fill_span (row(y)+cr.x, cr.w, c);
+}
+
+void RasterScreen::Canvas::copy (const Canvas& src, const Rect& sr, const Point& dp)
+{
+    // Clipped to both canvases; o is from source to destination
+    auto o = dp - sr.pos();
+    auto s = Rect (src.size()).clip (sr);
+    auto d = Rect (_size).clip (Rect (s.pos() + o, s.size()));
+    for (dim_t y = 0; y < d.h; ++y)
+	copy_n (src.row (d.y-o.dy+y) + (d.x-o.dx), d.w, row (d.y+y) + d.x);
+}
+
+static bool write_file (const char* filename, const void* p, size_t n)
+{
+    auto fd = open (filename, O_WRONLY| O_CREAT| O_TRUNC| O_CLOEXEC, 0644);
+    if (fd < 0)
+	return false;
+    for (auto d = static_cast<const char*>(p); n;) {
+	auto bw = write (fd, d, n);
+	if (bw > 0) {
+	    d += bw;
+	    n -= bw;
+	} else if (bw < 0 && errno == EINTR)
+	    continue;
+	else
+	    break;
+    }
+    return !close (fd) && !n;
+}
+
+bool RasterScreen::Canvas::write_ppm (const char* filename) const
+{
+    char hdr [32];
+    auto hsz = snprintf (hdr, sizeof(hdr), "P6\n%u %u\n255\n", _size.w, _size.h);
+    memblock o (hsz + _pixels.size()*3);
+    auto d = copy_n (hdr, hsz, o.data());
+    for (auto p : _pixels) {
+	*d++ = uint8_t(p);
+	*d++ = uint8_t(p>>8);
+	*d++ = uint8_t(p>>16);
+    }
+    return write_file (filename, o.data(), o.size());
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ PNG writer
+
+// PNG files are written with stored deflate blocks. They are as large
+// as a PPM, but readable by any viewer, and need no zlib.
+
+static uint32_t png_crc (const uint8_t* p, size_t n)
+{
+    static const struct CrcTable {
+	uint32_t t [256];
+	CrcTable (void) {
+	    for (auto i = 0u; i < size(t); ++i) {
+		auto c = i;
+		for (auto k = 0u; k < 8; ++k)
+		    c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		t[i] = c;
+	    }
+	}
+    } s_crc;
+    uint32_t c = UINT32_MAX;
+    for (auto i = 0u; i < n; ++i)
+	c = s_crc.t[(c ^ p[i]) & 0xff] ^ (c >> 8);
+    return ~c;
+}
+
+static uint32_t adler32 (const uint8_t* p, size_t n)
+{
+    enum { Base = 65521, MaxRun = 5552 };	// largest run without overflow
+    uint32_t a = 1, b = 0;
+    while (n) {
+	auto run = min (n, size_t(MaxRun));
+	for (n -= run; run; --run) {
+	    a += *p++;
+	    b += a;
+	}
+	a %= Base;
+	b %= Base;
+    }
+    return (b << 16) | a;
+}
+
+static uint8_t* write_be32 (uint8_t* o, uint32_t v)
+{
+    *o++ = v >> 24;
+    *o++ = v >> 16;
+    *o++ = v >> 8;
+    *o++ = v;
+    return o;
+}
+
+bool RasterScreen::Canvas::write_png (const char* filename) const
+{
+    enum { MaxBlock = UINT16_MAX, ChunkOverhead = 12 };
+    static constexpr const uint8_t c_Signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+    // Rows of RGB pixels, each after a filter type byte of 0, for none
+    const size_t rowsz = 1 + 3u*_size.w, rawsz = rowsz*_size.h;
+    const size_t nblocks = max (divide_ceil (rawsz, size_t(MaxBlock)), size_t(1));
+    const size_t zsz = 2 + 5*nblocks + rawsz + 4;
+    memblock o (sizeof(c_Signature) + ChunkOverhead+13 + ChunkOverhead+zsz + ChunkOverhead);
+    auto d = pointer_cast<uint8_t>(o.data());
+    d = copy_n (c_Signature, sizeof(c_Signature), d);
+
+    auto write_chunk = [&](const char* type, uint32_t n, auto write_data) {
+	d = write_be32 (d, n);
+	auto ctype = d;
+	memcpy (d, type, 4);
+	d += 4;
+	d = write_data (d);
+	d = write_be32 (d, png_crc (ctype, 4+n));
+    };
+    write_chunk ("IHDR", 13, [&](uint8_t* c) {
+	c = write_be32 (c, _size.w);
+	c = write_be32 (c, _size.h);
+	*c++ = 8;	// bits per channel
+	*c++ = 2;	// RGB
+	*c++ = 0;	// deflate
+	*c++ = 0;	// adaptive filtering
+	*c++ = 0;	// not interlaced
+	return c;
+    });
+    write_chunk ("IDAT", zsz, [&](uint8_t* c) {
+	*c++ = 0x78;	// deflate, 32k window
+	*c++ = 0x01;	// no compression, header check bits
+	// The raw data is written after room for the block headers, and each
+	// block is moved down over the headers before it
+	auto raw = c + 5*nblocks;
+	auto r = raw;
+	for (dim_t y = 0; y < _size.h; ++y) {
+	    *r++ = 0;
+	    for (auto p = row(y), pe = p + _size.w; p < pe; ++p) {
+		*r++ = uint8_t(*p);
+		*r++ = uint8_t(*p>>8);
+		*r++ = uint8_t(*p>>16);
+	    }
+	}
+	auto adler = adler32 (raw, rawsz);
+	for (size_t i = 0, left = rawsz; i < nblocks; ++i) {
+	    auto bsz = min (left, size_t(MaxBlock));
+	    left -= bsz;
+	    // Blocks move down by the headers of those before them
+	    memmove (c+5, raw + i*MaxBlock, bsz);
+	    *c++ = !left;	// last block flag, stored type
+	    *c++ = bsz;
+	    *c++ = bsz >> 8;
+	    *c++ = ~bsz;
+	    *c++ = ~bsz >> 8;
+	    c += bsz;
+	}
+	return write_be32 (c, adler);
+    });
+    write_chunk ("IEND", 0, [](uint8_t* c) { return c; });
+    return write_file (filename, o.data(), o.size());
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Renderer
+
+RasterScreen::Renderer::Renderer (Canvas& c)
+:_canvas (c)
+,_viewport()
+,_pos()
+,_caret (-1,-1)
+,_fg()
+,_bg()
+,_features()
+,_palette()
+{
+    reset_palette();
+    reset();
+}
+
+// The standard xterm palette: 16 named colors, a 6x6x6 cube, and grays
+void RasterScreen::Renderer::reset_palette (void)
+{
+    static constexpr const color_t c_Named[16] = {
+	RGB(0,0,0),	RGB(205,0,0),	RGB(0,205,0),	RGB(205,205,0),
+	RGB(0,0,238),	RGB(205,0,205),	RGB(0,205,205),	RGB(229,229,229),
+	RGB(127,127,127), RGB(255,0,0),	RGB(0,255,0),	RGB(255,255,0),
+	RGB(92,92,255),	RGB(255,0,255),	RGB(0,255,255),	RGB(255,255,255)
+    };
+    static constexpr auto cube_value = [](unsigned l) { return colray_t (l ? 55+40*l : 0); };
+    copy_n (c_Named, size(c_Named), _palette);
+    for (auto i = 16u; i < IColor::Gray0; ++i) {
+	auto ci = i-16;
+	_palette[i] = RGB (cube_value (ci/36), cube_value (ci/6%6), cube_value (ci%6));
+    }
+    for (auto i = 0u; i+IColor::Gray0 < size(_palette); ++i)
+	_palette[i+IColor::Gray0] = RGB (8+10*i, 8+10*i, 8+10*i);
+}
+
+void RasterScreen::Renderer::reset (void)
+{
+    _viewport = interior_area();
+    _pos = Point();
+    _caret = Point(-1,-1);
+    _features = 0;
+    Draw_draw_color (IColor::Default);
+    Draw_fill_color (IColor::Default);
+}
+
+// Draws a whole window; the canvas is cleared first
+void RasterScreen::Renderer::draw (const cmemlink& dl)
+{
+    reset();
+    _canvas.fill (interior_area(), _bg);
+    DrawlistGraphic::dispatch (this, dl);
+}
+
+void RasterScreen::Renderer::Draw_reset (void)
+{
+    reset_palette();
+    reset();
+}
+
+void RasterScreen::Renderer::Draw_enable (uint8_t f)
+{
+    if (f < Drawlist::Feature::Last)
+	set_bit (_features, f);
+}
+
+void RasterScreen::Renderer::Draw_disable (uint8_t f)
+{
+    if (f < Drawlist::Feature::Last)
+	set_bit (_features, f, false);
+}
+
+void RasterScreen::Renderer::Draw_move_to (const Point& p)
+    { _pos = _viewport.pos() + p; }
+void RasterScreen::Renderer::Draw_move_by (const Offset& o)
+    { _pos += o; }
+void RasterScreen::Renderer::Draw_viewport (const Rect& vp)
+{
+    _viewport = interior_area().clip (vp);
+    _pos = _viewport.pos();
+}
+
+// Default colors are those of a terminal: light gray on black
+void RasterScreen::Renderer::Draw_draw_color (icolor_t c)
+    { _fg = _palette [c == IColor::Default ? icolor_t(IColor::Gray) : c]; }
+void RasterScreen::Renderer::Draw_fill_color (icolor_t c)
+    { _bg = _palette [c == IColor::Default ? icolor_t(IColor::Black) : c]; }
+
+void RasterScreen::Renderer::Draw_set_color (icolor_t c, color_t rgb)
+    { _palette[c] = rgb; }
+
+void RasterScreen::Renderer::Draw_palette (icolor_t f, const vector_view<color_t>& pal)
+{
+    for (auto i = 0u; i < pal.size() && f+i < size(_palette); ++i)
+	Draw_set_color (f+i, pal[i]);
+}
+
+void RasterScreen::Renderer::Draw_palette3 (icolor_t f, const vector_view<colray_t>& pal)
+{
+    for (auto i = 0u; i+2 < pal.size() && f+i/3 < size(_palette); i += 3)
+	Draw_set_color (f+i/3, RGB (pal[i], pal[i+1], pal[i+2]));
+}
+
+void RasterScreen::Renderer::Draw_clear (void)
+{
+    Draw_move_to (Point());
+    Draw_bar (_viewport.size());
+}
+
+void RasterScreen::Renderer::Draw_bar (const Size& wh)
+    { fill (Rect (_pos, wh), bgc()); }
+
+void RasterScreen::Renderer::Draw_line (const Offset& o)
+{
+    // The resulting position is at the end of the line. Lines are
+    // drawn from the start point up to, but not including, the end.
+    auto newpos = _pos + o;
+    if (!o.dx || !o.dy) {	// straight lines are filled as thin bars
+	auto x = o.dx < 0 ? newpos.x+1 : _pos.x, y = o.dy < 0 ? newpos.y+1 : _pos.y;
+	if (o.dx || o.dy)
+	    fill (Rect (x, y, max (abs (o.dx), 1), max (abs (o.dy), 1)), fgc());
+    } else {			// Bresenham
+	int dx = abs (o.dx), dy = -abs (o.dy), e = dx+dy;
+	int sx = o.dx > 0 ? 1 : -1, sy = o.dy > 0 ? 1 : -1;
+	for (auto p = _pos; p != newpos;) {
+	    if (_viewport.contains (p))
+		_canvas.row (p.y)[p.x] = fgc();
+	    auto e2 = 2*e;
+	    if (e2 >= dy) {
+		e += dy;
+		p.x += sx;
+	    }
+	    if (e2 <= dx) {
+		e += dx;
+		p.y += sy;
+	    }
+	}
+    }
+    _pos = newpos;
+}
+
+void RasterScreen::Renderer::Draw_box (const Size& wh)
+{
+    if (!wh.w || !wh.h)
+	return;
+    auto c = fgc();
+    fill (Rect (_pos, Size (wh.w, 1)), c);
+    fill (Rect (_pos.x, _pos.y+wh.h-1, wh.w, 1), c);
+    fill (Rect (_pos.x, _pos.y+1, 1, max (wh.h, dim_t(2))-2), c);
+    fill (Rect (_pos.x+wh.w-1, _pos.y+1, 1, max (wh.h, dim_t(2))-2), c);
+}
+
+void RasterScreen::Renderer::bevel (const Rect& r, bool raised)
+{
+    auto light = _palette [IColor::White], shadow = _palette [IColor::DarkGray];
+    if (!raised)
+	swap (light, shadow);
+    fill (Rect (r.x, r.y, r.w, 1), light);
+    fill (Rect (r.x, r.y+1, 1, r.h-1), light);
+    fill (Rect (r.x+1, r.y+r.h-1, r.w-1, 1), shadow);
+    fill (Rect (r.x+r.w-1, r.y+1, 1, r.h-2), shadow);
+}
+
+void RasterScreen::Renderer::Draw_panel (const Size& wh, PanelType t)
+{
+    Rect r (_pos, wh);
+    if (r.w < 2 || r.h < 2)
+	return;
+    // Check and radio boxes are a square the height of a line of text
+    Rect cb (_pos.x+2, _pos.y+2, GlyphH-4, GlyphH-4);
+    switch (t) {
+	case PanelType::Raised:
+	case PanelType::Button:
+	    fill (r, bgc());
+	    bevel (r, true);
+	    break;
+	case PanelType::Sunken:
+	case PanelType::ButtonOn:
+	case PanelType::Listbox:
+	case PanelType::Selbox:
+	case PanelType::Scrollbar:
+	case PanelType::Progress:
+	    fill (r, bgc());
+	    bevel (r, false);
+	    break;
+	case PanelType::Editbox:
+	case PanelType::FocusedEditbox:
+	    fill (r, bgc());
+	    bevel (r, false);
+	    if (t == PanelType::FocusedEditbox)
+		fill (Rect (r.x+1, r.y+r.h-2, r.w-2, 1), fgc());
+	    break;
+	case PanelType::Selection:
+	case PanelType::Statusbar:
+	case PanelType::ProgressOn:
+	    fill (r, fgc());
+	    break;
+	case PanelType::Checkbox:
+	case PanelType::CheckboxOn:
+	case PanelType::Radio:
+	case PanelType::RadioOn:
+	    fill (cb, bgc());
+	    bevel (cb, false);
+	    if (t == PanelType::CheckboxOn)
+		fill (Rect (cb.x+2, cb.y+2, cb.w-4, cb.h-4), fgc());
+	    else if (t == PanelType::RadioOn)
+		fill (Rect (cb.x+cb.w/2-1, cb.y+cb.h/2-1, 2, 2), fgc());
+	    break;
+	case PanelType::MoreLeft:	put_gchar (Drawlist::GChar::LeftArrow, _pos); break;
+	case PanelType::MoreRight:	put_gchar (Drawlist::GChar::RightArrow, _pos); break;
+	case PanelType::MoreUp:		put_gchar (Drawlist::GChar::UpArrow, _pos); break;
+	case PanelType::MoreDown:	put_gchar (Drawlist::GChar::DownArrow, _pos); break;
+    }
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Renderer text
+
+// Graphical chars are drawn to fill the cell, so that lines and
+// blocks in adjacent cells join.
+void RasterScreen::Renderer::put_gchar (Drawlist::GChar c, const Point& p)
+{
+    using GChar = Drawlist::GChar;
+    enum { Left = 1, Right = 2, Up = 4, Down = 8 };
+    static constexpr const uint8_t c_arms [uint8_t(GChar::N)] = {
+	0, 0, 0, 0, 0,				// RightArrow, LeftArrow, UpArrow, DownArrow, Block
+	0, 0, 0, 0, 0,				// Diamond, Checkerboard, Degree, PlusMinus, Board
+	0, Left|Up, Left|Down, Right|Down, Right|Up,	// Lantern, LRCorner, URCorner, ULCorner, LLCorner
+	Left|Right|Up|Down, 0, 0, Left|Right, 0,	// Plus, HLine1, HLine3, HLine, HLine7
+	0, Right|Up|Down, Left|Up|Down, Left|Right|Up, Left|Right|Down, // HLine9, LeftT, RightT, BottomT, TopT
+	Up|Down, 0, 0, 0, 0,			// VLine, LessEqual, GreaterEqual, Pi, NotEqual
+	0, 0					// Sterling, Bullet
+    };
+    // Approximations of chars not drawn here, from the font
+    static constexpr const char c_subst [uint8_t(GChar::N)+1] =
+	"     " "   +#" "#    " " ----" "-    " " <>n#" "L ";
+
+    auto fc = fgc();
+    auto cx = p.x + GlyphW/2, cy = p.y + GlyphH/2;
+    auto gi = uint8_t(c) - uint8_t(GChar::First);
+    if (auto arms = c_arms[gi]; arms) {
+	if (arms & Left)
+	    fill (Rect (p.x, cy, cx-p.x+1, 1), fc);
+	if (arms & Right)
+	    fill (Rect (cx, cy, p.x+GlyphW-cx, 1), fc);
+	if (arms & Up)
+	    fill (Rect (cx, p.y, 1, cy-p.y+1), fc);
+	if (arms & Down)
+	    fill (Rect (cx, cy, 1, p.y+GlyphH-cy), fc);
+	return;
+    }
+    switch (c) {
+	case GChar::HLine1:	fill (Rect (p.x, p.y, GlyphW, 1), fc); break;
+	case GChar::HLine3:	fill (Rect (p.x, p.y+GlyphH/4, GlyphW, 1), fc); break;
+	case GChar::HLine7:	fill (Rect (p.x, p.y+GlyphH*3/4, GlyphW, 1), fc); break;
+	case GChar::HLine9:	fill (Rect (p.x, p.y+GlyphH-1, GlyphW, 1), fc); break;
+	case GChar::Block:	fill (Rect (p, Size (GlyphW, GlyphH)), fc); break;
+	case GChar::Bullet:	fill (Rect (cx-1, cy-1, 2, 2), fc); break;
+	case GChar::Lantern:	fill (Rect (cx-2, cy-3, 4, 6), fc); break;
+	case GChar::Checkerboard:
+	case GChar::Board:
+	    // Board is every other pixel of every other row
+	    for (auto y = 0u; y < GlyphH; ++y)
+		for (auto x = (y & 1); x < GlyphW; x += 2)
+		    if (c == GChar::Checkerboard || !(y & 1))
+			fill (Rect (p.x+x, p.y+y, 1, 1), fc);
+	    break;
+	case GChar::Diamond:
+	case GChar::RightArrow:
+	case GChar::LeftArrow:
+	case GChar::UpArrow:
+	case GChar::DownArrow:
+	    // Triangles and a diamond, as lines growing from the point
+	    for (auto i = 0; i < 4; ++i) {
+		if (c == GChar::RightArrow)
+		    fill (Rect (cx+1-i, cy-i, 1, 2*i+1), fc);
+		else if (c == GChar::LeftArrow)
+		    fill (Rect (cx-2+i, cy-i, 1, 2*i+1), fc);
+		else if (c == GChar::UpArrow)
+		    fill (Rect (cx-i, cy-2+i, 2*i+1, 1), fc);
+		else if (c == GChar::DownArrow)
+		    fill (Rect (cx-i, cy+1-i, 2*i+1, 1), fc);
+		else {
+		    fill (Rect (cx-i, cy-3+i, 2*i+1, 1), fc);
+		    fill (Rect (cx-i, cy+3-i, 2*i+1, 1), fc);
+		}
+	    }
+	    break;
+	case GChar::Degree:
+	    fill (Rect (cx-1, p.y+1, 3, 1), fc);
+	    fill (Rect (cx-1, p.y+3, 3, 1), fc);
+	    fill (Rect (cx-1, p.y+2, 1, 1), fc);
+	    fill (Rect (cx+1, p.y+2, 1, 1), fc);
+	    break;
+	default:
+	    put_glyph (c_subst[gi], p);
+	    break;
+    }
+}
+
+void RasterScreen::Renderer::put_glyph (char32_t c, const Point& p)
+{
+    auto fc = fgc();
+    auto w = max (char_width (c), 1u);
+    if (c >= char32_t(Drawlist::GChar::First) && c < char32_t(Drawlist::GChar::Last))
+	put_gchar (Drawlist::GChar(c), p);
+    else if (c > ' ' && c <= '~') {
+	// Runs of set bits in each font row are filled as one span
+	auto g = c_Font3x5 [c-' '];
+	auto bold = feature (Drawlist::Feature::BoldText);
+	for (auto y = 0u; y < c_FontH; ++y) {
+	    auto bits = (g >> (c_FontW*(c_FontH-1-y))) & ((1u << c_FontW)-1);
+	    for (auto x = 0u; x < c_FontW;) {
+		if (!(bits & (1u << (c_FontW-1-x)))) {
+		    ++x;
+		    continue;
+		}
+		auto rs = x;
+		while (x < c_FontW && (bits & (1u << (c_FontW-1-x))))
+		    ++x;
+		fill (Rect (p.x+1+c_FontScale*rs, p.y+1+c_FontScale*y, c_FontScale*(x-rs)+bold, c_FontScale), fc);
+	    }
+	}
+    } else if (c != ' ')	// chars not in the font are boxes
+	fill (Rect (p.x+1, p.y+1, GlyphW*w-2, GlyphH-2), fc);
+    if (feature (Drawlist::Feature::UnderlineText))
+	fill (Rect (p.x, p.y+GlyphH-1, GlyphW*w, 1), fc);
+}
+
+void RasterScreen::Renderer::Draw_char (char32_t c, HAlign, VAlign)
+{
+    if (auto w = char_width (c); w) {
+	put_glyph (c, _pos);
+	_pos.x += GlyphW*w;
+    }
+}
+
+void RasterScreen::Renderer::Draw_char_bar (const Size& wh, char32_t c)
+{
+    if (c == ' ')
+	return Draw_bar (wh);
+    // The char is repeated in cells covering the bar, clipped to it
+    auto oldvp = _viewport;
+    _viewport = _viewport.clip (Rect (_pos, wh));
+    for (auto y = 0u; y < wh.h; y += GlyphH)
+	for (auto x = 0u; x < wh.w; x += GlyphW*max (char_width (c), 1u))
+	    put_glyph (c, Point (_pos.x+x, _pos.y+y));
+    _viewport = oldvp;
+}
+
+void RasterScreen::Renderer::Draw_edit_text (const string& t, uint32_t cp, HAlign ha, VAlign va)
+{
+    auto nlines = 1u + count (t,'\n');
+    if (va == VAlign::Center)
+	_pos.y -= nlines*GlyphH/2;
+    else if (va == VAlign::Bottom)
+	_pos.y -= nlines*GlyphH;
+
+    auto lsz = 0u;
+    auto tx = _pos.x, ly = _pos.y;
+
+    vector<char32_t> wt (t.length());
+    copy (t.wbegin(), t.wend(), wt.begin());
+
+    // Caret position iterator
+    auto cpi = wt.begin();
+    if (cp <= wt.size())
+	cpi += cp;
+    else
+	cpi = nullptr;
+    Point caret (-1,-1);
+
+    for (auto l = wt.begin(), tend = wt.end(); l < tend; ly += GlyphH) {
+	auto lend = find (l, tend, char32_t('\n'));
+	if (!lend)
+	    lend = tend;
+	lsz = 0;
+	for (auto i = l; i < lend; ++i)
+	    lsz += char_width (*i);
+	int lx = tx;
+	if (ha == HAlign::Center)
+	    lx -= int(lsz*GlyphW/2);
+	else if (ha == HAlign::Right)
+	    lx -= int(lsz*GlyphW);
+	for (auto x = lx; l <= lend; ++l) {
+	    if (l == cpi)
+		caret = Point (x, ly);
+	    if (l == lend)
+		break;
+	    if (auto w = char_width (*l); w) {
+		put_glyph (*l, Point (x, ly));
+		x += GlyphW*w;
+	    }
+	}
+	l = lend+1;	// go to next line
+    }
+    if (cp == 0 && wt.empty())
+	caret = _pos;
+    if (caret.x >= 0) {
+	_caret = caret;
+	fill (Rect (caret, Size (1, GlyphH)), fgc());
+    }
+    // End position is after the last line, or its left edge for
+    // Center and Right alignments, as in the terminal
+    _pos.y = ly-GlyphH;
+    _pos.x = tx;
+    if (ha == HAlign::Center)
+	_pos.x -= lsz*GlyphW/2;
+    else if (ha == HAlign::Right)
+	_pos.x -= lsz*GlyphW;
+    else
+	_pos.x += lsz*GlyphW;
+}
+
+void RasterScreen::Renderer::Draw_text (const string& t, HAlign ha, VAlign va)
+    { Draw_edit_text (t, UINT32_MAX, ha, va); }
+
+//}}}-------------------------------------------------------------------
+//{{{ RasterScreen
+
+RasterScreen::RasterScreen (void)
+:_scrinfo (Size (c_DefaultW, c_DefaultH), ScreenType::Graphics, 24)
+,_canvas()
+,_windows()
+{
+    _canvas.resize (_scrinfo.size());
+}
+
+void RasterScreen::resize (const Size& sz)
+{
+    _scrinfo.set_size (sz);
+    _canvas.resize (sz);
+    for (auto w : _windows)
+	w->on_new_screen_info();
+    compose (Rect (sz));
+}
+
+void RasterScreen::register_window (RasterScreenWindow* w)
+{
+    _windows.push_back (w);
+}
+
+void RasterScreen::unregister_window (const RasterScreenWindow* w)
+{
+    remove (_windows, w);
+    compose (w->area());
+}
+
+Rect RasterScreen::position_window (const WindowInfo& winfo) const
+{
+    // Find parent window to position in; if none, use screen
+    auto parwin = find_if (_windows, [&](auto& w){ return w->window_id() == winfo.parent(); });
+    Rect scrarea (screen_info().size());
+    auto pararea = parwin ? (*parwin)->area() : scrarea;
+
+    // Window area is specified in parent coordinates
+    auto warea = winfo.area();
+    warea.move_by (pararea.pos().as_offset());
+
+    // Maximize window if empty
+    if (!warea.w)
+	warea.w = pararea.w;
+    if (!warea.h)
+	warea.h = pararea.h;
+
+    // Center dialogs and toplevel windows
+    if (!parwin || winfo.type() == WindowInfo::Type::Dialog) {
+	warea.x = pararea.x + (pararea.w - warea.w)/2;
+	warea.y = pararea.y + (pararea.h - warea.h)/2;
+    }
+    return scrarea.clip (warea);
+}
+
+// Copies the windows in r onto the screen, bottom first
+void RasterScreen::compose (const Rect& r)
+{
+    auto cr = Rect (_canvas.size()).clip (r);
+    if (cr.empty())
+	return;
+    _canvas.fill (cr, RGB (0,0,0));
+    for (auto w : _windows) {
+	auto wr = w->area().clip (cr);
+	if (!wr.empty())
+	    _canvas.copy (w->canvas(), Rect (wr.pos() - w->area().pos().as_offset(), wr.size()), wr.pos());
+    }
+}
+
+bool RasterScreen::snapshot (const char* filename) const
+{
+    auto n = strlen (filename);
+    if (n > 4 && !strcmp (filename+n-4, ".png"))
+	return _canvas.write_png (filename);
+    return _canvas.write_ppm (filename);
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ RasterScreenWindow
+
+IMPLEMENT_INTERFACES_D (RasterScreenWindow)
+
+RasterScreenWindow::RasterScreenWindow (Msg::Link l)
+: Msger (l)
+,_winfo()
+,_canvas()
+,_renderer (_canvas)
+{
+    screen().register_window (this);
+}
+
+RasterScreenWindow::~RasterScreenWindow (void)
+{
+    screen().unregister_window (this);
+}
+
+void RasterScreenWindow::Screen_open (const WindowInfo& wi)
+{
+    _winfo = wi;
+    on_resize (screen().position_window (_winfo));
+}
+
+void RasterScreenWindow::on_resize (const Rect& warea)
+{
+    auto oldarea = area();
+    _winfo.set_area (warea);
+    _canvas.resize (warea.size());
+    _renderer.reset();
+    screen().compose (oldarea);
+    IScreen::Reply (creator_link()).resize (_winfo);
+}
+
+void RasterScreenWindow::on_new_screen_info (void)
+{
+    if (auto newarea = screen().position_window (window_info()); newarea != area())
+	on_resize (newarea);
+    IScreen::Reply (creator_link()).screen_info (screen_info());
+}
+
+// The framebuffer is updated right away, so the window may draw again
+void RasterScreenWindow::Screen_draw (const cmemlink& dl)
+{
+    _renderer.draw (dl);
+    screen().compose (area());
+    IScreen::Reply (creator_link()).event (Event (Event::Type::VSync));
+}
+
+//}}}-------------------------------------------------------------------
+
+} // namespace cwiclui
@@ -0,0 +1,145 @@
+// This file is part of the cwiclui project
+//
+// Copyright (c) 2021 by Mike Sharov <msharov@users.sourceforge.net>
+// This file is free software, distributed under the ISC License.
+
+#pragma once
+#include "draw.h"
+#include <cwiclo/app.h>
+
+namespace cwiclui {
+
+class RasterScreenWindow;
+
+//----------------------------------------------------------------------
+
+// A screen in memory, with windows drawn in software into a framebuffer.
+// Coordinates are in pixels, and text is drawn with a built-in font in
+// cells of GlyphW x GlyphH. The framebuffer can be saved as PPM or PNG,
+// for tests without a display.
+class RasterScreen {
+public:
+    using pixel_t	= color_t;
+    enum { GlyphW = 8, GlyphH = 12 };
+    //{{{ Canvas
+    // An RGBA pixel buffer, in the byte order of RGBA()
+    class Canvas {
+    public:
+			Canvas (void)		:_size(),_pixels() {}
+	void		resize (const Size& sz);
+	auto&		size (void) const	{ return _size; }
+	auto		row (coord_t y)		{ return &_pixels[y*_size.w]; }
+	auto		row (coord_t y) const	{ return &_pixels[y*_size.w]; }
+	auto		pixel (coord_t x, coord_t y) const	{ return row(y)[x]; }
+	void		fill (const Rect& r, pixel_t c);
+	void		copy (const Canvas& src, const Rect& sr, const Point& dp);
+	bool		write_ppm (const char* filename) const;
+	bool		write_png (const char* filename) const;
+	static void	fill_span (pixel_t* p, dim_t n, pixel_t c);
+    private:
+	Size		_size;
+	vector<pixel_t>	_pixels;
+    };
+    //}}}
+    //{{{ Renderer
+    // Draws drawlists on a canvas
+    class Renderer {
+    public:
+	using PanelType	= Drawlist::PanelType;
+    public:
+	explicit	Renderer (Canvas& c);
+	void		draw (const cmemlink& dl);
+	void		reset (void);
+	void		reset_palette (void);
+	auto&		caret (void) const	{ return _caret; }
+	pixel_t		color (icolor_t c) const	{ return _palette[c]; }
+    private:
+		    friend class Drawlist;
+		    friend class DrawlistGraphic;
+	Rect		interior_area (void) const	{ return Rect (_canvas.size()); }
+	void		fill (const Rect& r, pixel_t c)	{ _canvas.fill (_viewport.clip (r), c); }
+	bool		feature (uint8_t f) const	{ return get_bit (_features, f); }
+	pixel_t		fgc (void) const		{ return feature (Drawlist::Feature::ReverseColors) ? _bg : _fg; }
+	pixel_t		bgc (void) const		{ return feature (Drawlist::Feature::ReverseColors) ? _fg : _bg; }
+	void		put_glyph (char32_t c, const Point& p);
+	void		put_gchar (Drawlist::GChar c, const Point& p);
+	void		bevel (const Rect& r, bool raised);
+	inline void	Draw_reset (void);
+	void		Draw_clear (void);
+	inline void	Draw_enable (uint8_t feature);
+	inline void	Draw_disable (uint8_t feature);
+	inline void	Draw_move_to (const Point& p);
+	inline void	Draw_move_by (const Offset& o);
+	inline void	Draw_viewport (const Rect& vp);
+	void		Draw_line (const Offset& o);
+	inline void	Draw_draw_color (icolor_t c);
+	inline void	Draw_fill_color (icolor_t c);
+	void		Draw_set_color (icolor_t c, color_t rgb);
+	void		Draw_palette (icolor_t f, const vector_view<color_t>& pal);
+	void		Draw_palette3 (icolor_t f, const vector_view<colray_t>& pal);
+	void		Draw_char (char32_t c, HAlign ha = HAlign::Left, VAlign va = VAlign::Top);
+	inline void	Draw_text (const string& t, HAlign ha = HAlign::Left, VAlign va = VAlign::Top);
+	void		Draw_box (const Size& wh);
+	inline void	Draw_bar (const Size& wh);
+	void		Draw_char_bar (const Size& wh, char32_t c);
+	void		Draw_panel (const Size& wh, PanelType t);
+	void		Draw_edit_text (const string& t, uint32_t cp, HAlign ha, VAlign va);
+    private:
+	Canvas&		_canvas;
+	Rect		_viewport;
+	Point		_pos,_caret;
+	pixel_t		_fg,_bg;
+	uint8_t		_features;	// Drawlist::Feature bits
+	pixel_t		_palette [256];
+    };
+    //}}}
+public:
+    static auto& instance (void) { static RasterScreen s_scr; return s_scr; }
+    auto&	screen_info (void) const	{ return _scrinfo; }
+    auto&	canvas (void) const		{ return _canvas; }
+    void	resize (const Size& sz);
+    void	register_window (RasterScreenWindow* w);
+    void	unregister_window (const RasterScreenWindow* w);
+    Rect	position_window (const WindowInfo& winfo) const;
+    void	compose (const Rect& r);
+    // Saves the screen as PNG if the name ends in .png, or else as PPM
+    bool	snapshot (const char* filename) const;
+private:
+		RasterScreen (void);
+private:
+    ScreenInfo	_scrinfo;
+    Canvas	_canvas;
+    vector<RasterScreenWindow*> _windows;	// in stacking order, bottom first
+};
+
+//----------------------------------------------------------------------
+
+class RasterScreenWindow : public Msger {
+    IMPLEMENT_INTERFACES_I (Msger, (IScreen),)
+public:
+    using Canvas	= RasterScreen::Canvas;
+    using Renderer	= RasterScreen::Renderer;
+public:
+		RasterScreenWindow (Msg::Link l);
+		~RasterScreenWindow (void) override;
+    auto&	screen (void) const		{ return RasterScreen::instance(); }
+    auto&	screen_info (void) const	{ return screen().screen_info(); }
+    auto&	window_info (void) const	{ return _winfo; }
+    auto	window_id (void) const		{ return msger_id(); }
+    auto&	area (void) const		{ return window_info().area(); }
+    auto&	canvas (void) const		{ return _canvas; }
+    void	on_new_screen_info (void);
+private:
+		friend class IScreen;
+    void	Screen_open (const WindowInfo& wi);
+    void	Screen_draw (const cmemlink& dl);
+    void	Screen_get_info (void)		{ IScreen::Reply (creator_link()).screen_info (screen_info()); }
+    void	Screen_close (void)		{ set_unused (true); }
+    void	on_resize (const Rect& warea);
+private:
+    WindowInfo	_winfo;
+    Canvas	_canvas;
+    Renderer	_renderer;
+};
+
+} // namespace cwiclui
@@ -0,0 +1,186 @@
+// This file is part of the cwiclui project
+//
+// Copyright (c) 2021 by Mike Sharov <msharov@users.sourceforge.net>
+// This file is free software, distributed under the ISC License.
+
+#include "terminfo.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace cwiclui {
+
+//{{{ Capability indexes -----------------------------------------------
+
+// Indexes of the used capabilities in the compiled entry, in term.h order
+static constexpr const uint8_t c_bool_index[] = { 1, 4, 28 };
+static constexpr const uint16_t c_num_index[] = { 13 };
+static constexpr const uint16_t c_str_index[] = {
+    3, 5, 6, 8, 10, 13, 16, 28, 37, 40,			// csr - rmcup
+    106, 107, 110, 111, 112, 114, 121, 127,		// dl - vpa
+    148, 59, 61, 164,					// kcbt - kend
+    66, 68, 69, 70, 71, 72, 73, 74, 75, 67, 216, 217,	// kf1 - kf12
+    76, 77, 79, 81, 82, 83, 87				// khome - kcuu1
+};
+static_assert (size(c_bool_index) == size_t(Terminfo::Bool::Last), "c_bool_index must have an entry for each Terminfo::Bool");
+static_assert (size(c_bool_index) <= 8, "Terminfo::_bools must have a bit for each Terminfo::Bool");
+static_assert (size(c_num_index) == size_t(Terminfo::Num::Last), "c_num_index must have an entry for each Terminfo::Num");
+static_assert (size(c_str_index) == size_t(Terminfo::Str::Last), "c_str_index must have an entry for each Terminfo::Str");
+
+//}}}-------------------------------------------------------------------
+//{{{ Loading
+
+// Opens the compiled entry, searching directories in ncurses order.
+// When TERMINFO is set, it is the only directory searched.
+static int open_entry (const char* term)
+{
+    if (!term[0] || strchr (term, '/'))
+	return -1;
+    auto open_in = [term](const char* d, size_t dn) {
+	// Entries are in subdirectories named by their first letter, or its hex code on macOS
+	char path [PATH_MAX];
+	if (snprintf (ARRAY_BLOCK(path), "%.*s/%c/%s", int(dn), d, term[0], term) < int(size(path)))
+	    if (auto fd = open (path, O_RDONLY| O_CLOEXEC); fd >= 0)
+		return fd;
+	if (snprintf (ARRAY_BLOCK(path), "%.*s/%02x/%s", int(dn), d, uint8_t(term[0]), term) < int(size(path)))
+	    if (auto fd = open (path, O_RDONLY| O_CLOEXEC); fd >= 0)
+		return fd;
+	return -1;
+    };
+    if (auto d = getenv("TERMINFO"); d)
+	return open_in (d, strlen(d));
+    if (auto d = getenv("HOME"); d) {
+	char hd [PATH_MAX];
+	if (auto hdn = snprintf (ARRAY_BLOCK(hd), "%s/.terminfo", d); hdn < int(size(hd)))
+	    if (auto fd = open_in (hd, hdn); fd >= 0)
+		return fd;
+    }
+    if (auto dl = getenv("TERMINFO_DIRS"); dl) {
+	for (auto d = dl; *d;) {
+	    auto de = strchrnul (d, ':');
+	    if (de > d)
+		if (auto fd = open_in (d, de-d); fd >= 0)
+		    return fd;
+	    d = *de ? de+1 : de;
+	}
+    }
+    static constexpr const char* c_dirs[] = { "/etc/terminfo", "/lib/terminfo", "/usr/share/terminfo", "/usr/local/share/terminfo" };
+    for (auto d : c_dirs)
+	if (auto fd = open_in (d, strlen(d)); fd >= 0)
+	    return fd;
+    return -1;
+}
+
+bool Terminfo::load (const char* term)
+{
+    auto fd = open_entry (term);
+    if (fd < 0)
+	return false;
+    auto r = false;
+    if (struct stat st; !fstat (fd, &st) && st.st_size > 0) {
+	if (auto p = mmap (nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0); p != MAP_FAILED) {
+	    r = parse (static_cast<const uint8_t*>(p), st.st_size);
+	    munmap (p, st.st_size);
+	}
+    }
+    close (fd);
+    return r;
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Parsing
+
+bool Terminfo::parse (const uint8_t* p, size_t n)
+{
+    // All values are little-endian; numbers are 32 bit in the newer format
+    enum { c_Magic16 = 0432, c_Magic32 = 01036 };
+    auto rd16 = [p](size_t o) { return int(int16_t(p[o] | p[o+1]<<8)); };
+    if (n < 12)
+	return false;
+    auto magic = rd16 (0);
+    if (magic != c_Magic16 && magic != c_Magic32)
+	return false;
+    size_t numsz = magic == c_Magic32 ? 4 : 2;
+    auto rdnum = [p,numsz,rd16](size_t o) { return numsz == 4 ? int32_t(p[o] | p[o+1]<<8 | p[o+2]<<16 | uint32_t(p[o+3])<<24) : rd16(o); };
+
+    // Header has sizes of names, bools, numbers, string offsets, and the string table
+    auto nnames = rd16 (2), nbools = rd16 (4), nnums = rd16 (6), nstrs = rd16 (8), strsz = rd16 (10);
+    if (nnames < 0 || nbools < 0 || nnums < 0 || nstrs < 0 || strsz < 0)
+	return false;
+    size_t bo = 12+nnames, no = bo+nbools;
+    no += no & 1;	// numbers are aligned to 2
+    size_t so = no+nnums*numsz, to = so+nstrs*2, te = to+strsz;
+    if (te > n)
+	return false;
+
+    // Absent and cancelled capabilities are negative
+    _bools = 0;
+    for (auto i = 0u; i < size(c_bool_index); ++i)
+	set_bit (_bools, i, c_bool_index[i] < nbools && p[bo+c_bool_index[i]] == 1);
+    for (auto i = 0u; i < size(c_num_index); ++i)
+	_nums[i] = c_num_index[i] < nnums ? max (rdnum (no+c_num_index[i]*numsz), -1) : -1;
+    _strtab.clear();
+    _strtab.push_back (0);
+    for (auto i = 0u; i < size(c_str_index); ++i) {
+	_stroff[i] = 0;
+	auto off = c_str_index[i] < nstrs ? rd16 (so+c_str_index[i]*2) : -1;
+	if (off < 0 || off >= strsz)
+	    continue;
+	auto s = pointer_cast<char>(p+to+off);
+	auto sn = strnlen (s, strsz-off);
+	_stroff[i] = _strtab.size();
+	_strtab.append (s, sn);
+	_strtab.push_back (0);
+    }
+
+    // The extended section, if present, has user-defined capabilities,
+    // like RGB and Tc for truecolor. Only the names of those present
+    // are kept. The string table has values of the extended strings,
+    // followed by the names of all extended capabilities.
+    _ext.clear();
+    auto eo = te + (te & 1);
+    if (eo+10 > n)
+	return true;
+    auto nebools = rd16 (eo), nenums = rd16 (eo+2), nestrs = rd16 (eo+4), neitems = rd16 (eo+6), estrsz = rd16 (eo+8);
+    auto necaps = nebools+nenums+nestrs;
+    if (nebools < 0 || nenums < 0 || nestrs < 0 || estrsz < 0 || neitems < nestrs+necaps)
+	return true;
+    size_t ebo = eo+10, eno = ebo+nebools;
+    eno += eno & 1;
+    size_t eso = eno+nenums*numsz, eto = eso+neitems*2;
+    if (eto+estrsz > n)
+	return true;
+    size_t namebase = 0;
+    for (auto i = 0; i < nestrs; ++i)
+	if (auto off = rd16 (eso+i*2); off >= 0 && off < estrsz)
+	    namebase = max (namebase, off + strnlen (pointer_cast<char>(p+eto+off), estrsz-off) + 1);
+    for (auto i = 0; i < necaps; ++i) {
+	bool present;
+	if (i < nebools)
+	    present = p[ebo+i] == 1;
+	else if (i < nebools+nenums)
+	    present = rdnum (eno+(i-nebools)*numsz) >= 0;
+	else
+	    present = rd16 (eso+(i-nebools-nenums)*2) >= 0;
+	auto noff = namebase + rd16 (eso+(nestrs+i)*2);
+	if (!present || noff >= size_t(estrsz))
+	    continue;
+	auto name = pointer_cast<char>(p+eto+noff);
+	_ext.append (name, strnlen (name, estrsz-noff));
+	_ext.push_back (0);
+    }
+    return true;
+}
+
+bool Terminfo::has_ext (const char* name) const
+{
+    for (auto n = _ext.c_str(), ne = n+_ext.size(); n < ne; n += strlen(n)+1)
+	if (!strcmp (n, name))
+	    return true;
+    return false;
+}
+
+//}}}-------------------------------------------------------------------
+
+} // namespace cwiclui
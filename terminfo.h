@@ -0,0 +1,83 @@
+// This file is part of the cwiclui project
+//
+// Copyright (c) 2021 by Mike Sharov <msharov@users.sourceforge.net>
+// This file is free software, distributed under the ISC License.
+
+#pragma once
+#include "uidefs.h"
+
+namespace cwiclui {
+
+// Capabilities of the terminal from its compiled terminfo entry.
+// The entry file is mapped once, and the capabilities used by
+// TerminalScreen are copied from it into a table indexed by the
+// enums below. Parameterized strings are kept unexpanded.
+class Terminfo {
+public:
+    enum class Bool : uint8_t {
+	AutoRightMargin,	// am
+	EatNewlineGlitch,	// xenl
+	BackColorErase,		// bce
+	Last
+    };
+    enum class Num : uint8_t {
+	MaxColors,		// colors
+	Last
+    };
+    enum class Str : uint8_t {
+	ChangeScrollRegion,	// csr
+	ClearScreen,		// clear
+	ClrEol,			// el
+	ColumnAddress,		// hpa
+	CursorAddress,		// cup
+	CursorInvisible,	// civis
+	CursorNormal,		// cnorm
+	EnterCaMode,		// smcup
+	EraseChars,		// ech
+	ExitCaMode,		// rmcup
+	ParmDeleteLine,		// dl
+	ParmDownCursor,		// cud
+	ParmInsertLine,		// il
+	ParmLeftCursor,		// cub
+	ParmRightCursor,	// cuf
+	ParmUpCursor,		// cuu
+	RepeatChar,		// rep
+	RowAddress,		// vpa
+	KeyFirst,
+	KeyBtab = KeyFirst,	// kcbt
+	KeyDc,			// kdch1
+	KeyDown,		// kcud1
+	KeyEnd,			// kend
+	KeyF1,			// kf1
+	KeyF2, KeyF3, KeyF4, KeyF5, KeyF6, KeyF7, KeyF8, KeyF9, KeyF10, KeyF11,
+	KeyF12,			// kf12
+	KeyHome,		// khome
+	KeyIc,			// kich1
+	KeyLeft,		// kcub1
+	KeyNpage,		// knp
+	KeyPpage,		// kpp
+	KeyRight,		// kcuf1
+	KeyUp,			// kcuu1
+	KeyLast,
+	Last = KeyLast
+    };
+public:
+			Terminfo (void)		:_strtab(),_ext(),_nums{},_stroff{},_bools() {}
+    bool		load (const char* term);
+    bool		empty (void) const	{ return _strtab.empty(); }
+    bool		flag (Bool c) const	{ return get_bit (_bools, uint8_t(c)); }
+    auto		number (Num c) const	{ return _nums [uint8_t(c)]; }
+    bool		has (Str c) const	{ return _stroff [uint8_t(c)]; }
+    const char*		str (Str c) const	{ return has(c) ? _strtab.c_str() + _stroff [uint8_t(c)] : ""; }
+    bool		has_ext (const char* name) const PURE;
+private:
+    bool		parse (const uint8_t* p, size_t n);
+private:
+    string		_strtab;	// Str values, after a zero so that absent ones have offset 0
+    string		_ext;		// Names of extended capabilities present, zero-separated
+    int32_t		_nums [uint8_t(Num::Last)];	// -1 if absent
+    uint16_t		_stroff [uint8_t(Str::Last)];
+    uint8_t		_bools;
+};
+
+} // namespace cwiclui
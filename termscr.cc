@@ -5,6 +5,12 @@
 
 #include "termscr.h"
 #include <signal.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
+#if __x86_64__ || __i386__
+    #include <immintrin.h>
+#endif
 #if __has_include(<termio.h>)
     #include <termio.h>
 #else
@@ -15,8 +21,22 @@ namespace cwiclui {
 
 //{{{ Statics ----------------------------------------------------------
 
-// termios settings before TerminalScreen activation
-static struct termios s_old_termios = {};
+// Screens created, for finding the one a window is shown on
+static vector<TerminalScreen*> s_screens;
+
+// Frame clock limits
+enum { c_DefaultMaxFps = 60 };
+static constexpr const uint64_t c_MaxFrameInterval = 500000000;	// ns
+// On slow links, frames are limited to what can be written in this time
+static constexpr const uint64_t c_SlowFrameTime = 100000000;	// ns
+enum { c_MinFrameBudget = 256 };
+
+static uint64_t nstime (void)
+{
+    struct timespec t;
+    clock_gettime (CLOCK_MONOTONIC, &t);
+    return t.tv_sec*UINT64_C(1000000000) + t.tv_nsec;
+}
 
 //}}}-------------------------------------------------------------------
 //{{{ T_ terminal code strings
@@ -30,42 +50,143 @@ static struct termios s_old_termios = {};
 #define T_SET_DEFAULT_ATTRS	"\017" T_CSI "0;39;49m"
 #define T_CARET_ON		T_CSI "?25h"
 #define T_CARET_OFF		T_CSI "?25l"
-#define T_SKIP_N		T_CSI "%uC"
 #define T_MOVE_TO_ORIGIN	T_CSI "H"
-#define T_MOVE_TO		T_CSI "%u;%uH"
 #define T_CLEAR_TO_BOTTOM	T_CSI "J"
 #define T_CLEAR_SCREEN		T_MOVE_TO_ORIGIN T_CLEAR_TO_BOTTOM
+#define T_RESET_SCROLL_REGION	T_CSI "r"
+#define T_SYNC_UPDATE_BEGIN	T_CSI "?2026h"
+#define T_SYNC_UPDATE_END	T_CSI "?2026l"
+#define T_QUERY_SYNC_UPDATE	T_CSI "?2026$p"
+#define T_MOUSE_ON		T_CSI "?1002h" T_CSI "?1006h"
+#define T_MOUSE_OFF		T_CSI "?1006l" T_CSI "?1002l"
+#define T_PASTE_ON		T_CSI "?2004h"
+#define T_PASTE_OFF		T_CSI "?2004l"
+#define T_PASTE_END		T_CSI "201~"
+
+//}}}-------------------------------------------------------------------
+//{{{ Terminfo capabilities
+
+// Encoder sequences are enabled if terminfo has them in this form
+static constexpr const struct {
+    Terminfo::Str			str;
+    TerminalScreen::Encoder::Cap::ECap	cap;
+    char				seq [24];
+} c_encoder_caps[] = {
+    { Terminfo::Str::ChangeScrollRegion,TerminalScreen::Encoder::Cap::ScrollRegion,	T_CSI "%i%p1%d;%p2%dr" },
+    { Terminfo::Str::ParmInsertLine,	TerminalScreen::Encoder::Cap::InsertLine,	T_CSI "%p1%dL" },
+    { Terminfo::Str::ParmDeleteLine,	TerminalScreen::Encoder::Cap::DeleteLine,	T_CSI "%p1%dM" },
+    { Terminfo::Str::ParmUpCursor,	TerminalScreen::Encoder::Cap::CursorUp,		T_CSI "%p1%dA" },
+    { Terminfo::Str::ParmDownCursor,	TerminalScreen::Encoder::Cap::CursorDown,	T_CSI "%p1%dB" },
+    { Terminfo::Str::ParmRightCursor,	TerminalScreen::Encoder::Cap::CursorRight,	T_CSI "%p1%dC" },
+    { Terminfo::Str::ParmLeftCursor,	TerminalScreen::Encoder::Cap::CursorLeft,	T_CSI "%p1%dD" },
+    { Terminfo::Str::ColumnAddress,	TerminalScreen::Encoder::Cap::ColumnAddress,	T_CSI "%i%p1%dG" },
+    { Terminfo::Str::RowAddress,	TerminalScreen::Encoder::Cap::RowAddress,	T_CSI "%i%p1%dd" },
+    { Terminfo::Str::EraseChars,	TerminalScreen::Encoder::Cap::EraseChars,	T_CSI "%p1%dX" },
+    { Terminfo::Str::RepeatChar,	TerminalScreen::Encoder::Cap::RepeatChar,	"%p1%c" T_CSI "%p2%{1}%-%db" },
+    { Terminfo::Str::ClrEol,		TerminalScreen::Encoder::Cap::ClearToEol,	T_CSI "K" }
+};
+static_assert (size(c_encoder_caps) == TerminalScreen::Encoder::Cap::AutoWrap, "c_encoder_caps must have an entry for each Encoder::Cap sequence");
+
+// Key codes for terminfo key capabilities, in Terminfo::Str order
+static constexpr const Event::key_t c_terminfo_keys[] = {
+    KMod::Shift+Key::Tab, Key::Delete, Key::Down, Key::End,
+    Key::F1, Key::F2, Key::F3, Key::F4, Key::F5, Key::F6,
+    Key::F7, Key::F8, Key::F9, Key::F10, Key::F11, Key::F12,
+    Key::Home, Key::Insert, Key::Left, Key::PageDown, Key::PageUp, Key::Right, Key::Up
+};
+static_assert (size(c_terminfo_keys) == size_t(Terminfo::Str::KeyLast)-size_t(Terminfo::Str::KeyFirst), "c_terminfo_keys must have an entry for each Terminfo key");
 
 //}}}-------------------------------------------------------------------
 //{{{ TerminalScreen
 
 IMPLEMENT_INTERFACES_D (TerminalScreen)
 
-TerminalScreen::TerminalScreen (void)
+TerminalScreen::TerminalScreen (fd_t ifd, fd_t ofd, const char* term)
 : Msger()
 ,_windows()
+,_clients()
+,_queued()
 ,_tout()
 ,_tin()
 ,_surface()
+,_owner()
+,_uncovered()
 ,_scrinfo()
-,_lastcell (Surface::default_cell())
-,_curwpos()
+,_enc()
+,_vt()
+,_outlimit()
+,_outstalls()
+,_nextframe()
+,_framestart()
+,_framebytes()
+,_drainrate()
+,_maxfps (c_DefaultMaxFps)
+,_fps (c_DefaultMaxFps)
+,_frametimer (timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK| TFD_CLOEXEC))
+,_nframes()
+,_fstats()
+,_frames()
+,_ifd (ifd)
+,_ofd (ofd)
+,_oldtios()
 ,_ptermi (msger_id())
 ,_ptermo (msger_id())
+,_pframe (msger_id())
 {
+    s_screens.push_back (this);
     _tin.reserve (256);
-    if (auto term = getenv("TERM"); term) {
-	if (!strncmp (term, "linux", strlen("linux")))
-	    _scrinfo.set_depth (3);
-	else if (!strstr (term, "256"))
-	    _scrinfo.set_depth (4);
-    }
+    if (!term)
+	return;
+    auto linuxcon = !strncmp (term, "linux", strlen("linux"));
+    if (!linuxcon)
+	set_flag (f_XtermModes);	// the linux console has no mode queries or SGR mouse
+    auto truecolor = false;
+    if (_tinfo.load (term)) {
+	auto ncolors = _tinfo.number (Terminfo::Num::MaxColors);
+	_scrinfo.set_depth (ncolors >= 256 ? 8 : (ncolors >= 16 ? 4 : 3));
+	truecolor = ncolors >= 0x1000000 || _tinfo.has_ext ("RGB") || _tinfo.has_ext ("Tc");
+	uint16_t caps = 0;
+	for (auto& c : c_encoder_caps)
+	    set_bit (caps, c.cap, !strcmp (_tinfo.str (c.str), c.seq));
+	// Moving by autowrap requires the cursor to stay in the last column until the next char
+	set_bit (caps, Encoder::Cap::AutoWrap, _tinfo.flag (Terminfo::Bool::AutoRightMargin) && _tinfo.flag (Terminfo::Bool::EatNewlineGlitch));
+	set_bit (caps, Encoder::Cap::BackColorErase, _tinfo.flag (Terminfo::Bool::BackColorErase));
+	_enc.set_caps (caps);
+	load_terminfo_keys();
+    } else if (linuxcon)	// without terminfo, guess from the name
+	_scrinfo.set_depth (3);
+    else if (!strstr (term, "256"))
+	_scrinfo.set_depth (4);
+    // The environment describes only the controlling terminal
+    if (auto ct = getenv("COLORTERM"); ct && is_stdio() && (!strcmp (ct, "truecolor") || !strcmp (ct, "24bit")))
+	truecolor = !linuxcon;
+    if (truecolor)
+	_scrinfo.set_depth (24);
 }
 
 TerminalScreen::~TerminalScreen (void)
 {
     _windows.clear();
     tt_mode();
+    if (_frametimer >= 0)
+	close (_frametimer);
+    remove (s_screens, this);
+}
+
+TerminalScreen& TerminalScreen::client_screen (mrid_t id)
+{
+    for (auto s : s_screens)
+	if (find (s->_clients, id))
+	    return *s;
+    return instance();
+}
+
+TerminalScreen* TerminalScreen::window_screen (windowid_t id)
+{
+    for (auto s : s_screens)
+	if (find_if (s->_windows, [&](auto w){ return w->window_id() == id; }))
+	    return s;
+    return nullptr;
 }
 
 //}}}-------------------------------------------------------------------
@@ -75,23 +196,31 @@ void TerminalScreen::ui_mode (void)
 {
     if (flag (f_UIMode))
 	return;
-    signal (SIGTSTP, SIG_IGN);		// Disable suspend signal in addition to the key.
-    if (0 == tcgetattr (STDIN_FILENO, &s_old_termios)) {
-	auto tios = s_old_termios;
+    if (is_stdio())
+	signal (SIGTSTP, SIG_IGN);	// Disable suspend signal in addition to the key.
+    // Headless output goes to the emulator, and the tty is left alone
+    if (!flag (f_Headless) && 0 == tcgetattr (_ifd, &_oldtios)) {
+	auto tios = _oldtios;
 	tios.c_lflag &= ~(ICANON| ECHO);// No by-line buffering, no echo.
 	tios.c_iflag &= ~(IXON| IXOFF);	// No ^s scroll lock
 	tios.c_cc[VMIN] = 1;		// Read at least 1 character on each read().
 	tios.c_cc[VTIME] = 0;		// Disable time-based preprocessing (Esc sequences)
 	tios.c_cc[VQUIT] = 0xff;	// Disable ^\. Root window will handle.
 	tios.c_cc[VSUSP] = 0xff;	// Disable ^z. Suspends in UI mode result in garbage.
-	tcsetattr (STDIN_FILENO, TCSAFLUSH, &tios);
+	tcsetattr (_ifd, TCSAFLUSH, &tios);
     }
-    _tout =
+    _tout +=
 	T_ALTSCREEN_ON
 	T_ALTCHARSET_ENABLE
 	T_CARET_ON;
-    for (int fd = STDIN_FILENO; fd <= STDOUT_FILENO; ++fd)
-	make_fd_nonblocking (fd);
+    if (flag (f_XtermModes))
+	_tout +=
+	    T_QUERY_SYNC_UPDATE
+	    T_MOUSE_ON
+	    T_PASTE_ON;
+    make_fd_nonblocking (_ifd);
+    if (!flag (f_Headless) && _ofd != _ifd)
+	make_fd_nonblocking (_ofd);
     set_flag (f_CaretOn);
     set_flag (f_UIMode);
     update_screen_size();
@@ -101,32 +230,54 @@ void TerminalScreen::tt_mode (void)
 {
     if (!flag (f_UIMode))
 	return;
+    // The headless screen is printed as last shown, before it is cleared
+    if (flag (f_Headless)) {
+	_tout.write (_vt, _rec);
+	auto t = _vt.text();
+	t.appendf ("%zu bytes, %zu escape sequences\n", _vt.bytes(), _vt.sequences());
+	fputs (t.c_str(), stdout);
+    }
     _ptermi.stop();
-    if (!_tout.empty())
-	_ptermo.stop();
+    _queued.clear();
     reset();
+    compose_frame();
+    _ptermo.stop();
+    _pframe.stop();
     caret_state (true);
-    for (int fd = STDIN_FILENO; fd <= STDOUT_FILENO; ++fd)
-	make_fd_blocking (fd);
+    make_fd_blocking (_ifd);
+    if (!flag (f_Headless) && _ofd != _ifd)
+	make_fd_blocking (_ofd);
+    if (flag (f_XtermModes))
+	_tout +=
+	    T_PASTE_OFF
+	    T_MOUSE_OFF;
     _tout +=
 	T_ALTCHARSET_DISABLE
 	T_ALTSCREEN_OFF;
-    printf ("%s", _tout.c_str());
+    if (flag (f_Headless))
+	_tout.write (_vt, _rec);
+    while (!_tout.empty())
+	if (0 > _tout.write (_ofd, _rec) && errno != EINTR)
+	    break;
     _tout.clear();
-    if (s_old_termios.c_lflag)	// don't set termios if it wasn't read successfully in ui_mode
-	tcsetattr (STDIN_FILENO, TCSAFLUSH, &s_old_termios);
-    signal (SIGTSTP, SIG_DFL);	// reenable Ctrl-Z
+    if (_oldtios.c_lflag)	// don't set termios if it wasn't read successfully in ui_mode
+	tcsetattr (_ifd, TCSAFLUSH, &_oldtios);
+    if (is_stdio())
+	signal (SIGTSTP, SIG_DFL);	// reenable Ctrl-Z
     set_flag (f_UIMode, false);
 }
 
 void TerminalScreen::reset (void)
 {
-    _curwpos = Point();
-    _lastcell = Surface::default_cell();
+    _enc.reset();
     _surface.clear();
-    _tout +=
-	T_SET_DEFAULT_ATTRS
-	T_CLEAR_SCREEN;
+    // The screen is cleared in the next frame, and all windows redrawn on it
+    set_flag (f_ClearPending);
+    for (auto w : _windows) {
+	w->damage_all();
+	queue_draw (w);
+    }
+    _ptermo.wait_write (_ofd);
 }
 
 void TerminalScreen::caret_state (bool on)
@@ -140,10 +291,10 @@ void TerminalScreen::caret_state (bool on)
 void TerminalScreen::update_screen_size (void)
 {
     Size nsz (80, 24);
-    if (struct winsize ws; !ioctl (STDIN_FILENO, TIOCGWINSZ, &ws)) {
+    if (struct winsize ws; !flag (f_Headless) && !ioctl (_ifd, TIOCGWINSZ, &ws)) {
 	nsz.w = ws.ws_col;
 	nsz.h = ws.ws_row;
-    } else {
+    } else if (is_stdio()) {
 	if (auto e = getenv("COLUMNS"); e)
 	    if (auto w = atoi(e); w > 0)
 		nsz.w = w;
@@ -153,9 +304,15 @@ void TerminalScreen::update_screen_size (void)
     }
     if (_scrinfo.size() != nsz) {
 	_scrinfo.set_size (nsz);
+	_rec.write (Recorder::Type::Screen, 0, &nsz, sizeof(nsz));
+	// Without RGB colors, cells are compared and copied in the compact format
+	_surface.set_format (_scrinfo.depth() > 8 || Surface::escapes_full() ? Surface::Format::Full : Surface::Format::Compact);
 	_surface.resize (nsz);
+	_enc.set_screen_size (nsz);
+	_vt.resize (nsz);
 	for (auto& w : _windows)
 	    w->on_new_screen_info();
+	restack();
     }
     reset();
 }
@@ -173,21 +330,40 @@ void TerminalScreen::register_window (TerminalScreenWindow* w)
 {
     assert (w);
     assert (!find (_windows, w));
-    ui_mode();
     _windows.push_back (w);
+    // The window gets the screen size before it opens
+    if (!flag (f_UIMode))
+	update_screen_size();
+}
+
+void TerminalScreen::open_window (const TerminalScreenWindow* w)
+{
+    // The terminal is taken over only when a window is shown on it,
+    // so that one which moves to its parent's screen leaves it alone.
+    if (find (_windows, w))
+	ui_mode();
 }
 
 void TerminalScreen::unregister_window (const TerminalScreenWindow* w)
 {
     remove (_windows, w);
+    remove (_queued, w);
+    // Msger ids are reused, so the client is forgotten with its last
+    // window here, and must be added again for its next one
+    auto client = w->creator_link().src;
+    if (!find_if (_windows, [&](auto ow){ return ow->creator_link().src == client; }))
+	remove (_clients, client);
     if (_windows.empty())
 	tt_mode();
-    else {
-	// Redraw all windows to erase the one that was destroyed
-	reset();	// need to reset in case there was no window underneath
-	for (auto& bw : _windows)
-	    draw_window (bw);
-    }
+    else	// Redraw only what the destroyed window covered
+	restack();
+}
+
+void TerminalScreen::queue_draw (TerminalScreenWindow* w)
+{
+    if (!find (_queued, w))
+	_queued.push_back (w);
+    _ptermo.wait_write (_ofd);	// the frame is composed when output is writable
 }
 
 Rect TerminalScreen::position_window (const WindowInfo& winfo) const
@@ -217,184 +393,1493 @@ Rect TerminalScreen::position_window (const WindowInfo& winfo) const
     return scrarea.clip (warea);
 }
 
-//}}}-------------------------------------------------------------------
-//{{{ TerminalScreen draw_window
+// Marks no window in the owner map
+static constexpr const mrid_t c_NoOwner = numeric_limits<mrid_t>::max();
 
-void TerminalScreen::draw_window (const TerminalScreenWindow* w)
+void TerminalScreen::restack (const TerminalScreenWindow* resized)
 {
-    assert (flag (f_UIMode));
-    assert (Rect(screen_info().size()).clip (w->area()) == w->area() && "you must use position_window to set window area");
-    if (w->area().empty())
+    // Each screen cell is owned by the topmost window covering it.
+    // Windows later in the list are on top.
+    auto& scrsz = _surface.size();
+    vector<mrid_t> owner (scrsz.w*scrsz.h);
+    fill (owner, c_NoOwner);
+    for (auto w : _windows) {
+	auto& a = w->area();
+	for (dim_t y = 0; y < a.h; ++y)
+	    for (auto o = owner.iat ((a.y+y)*scrsz.w+a.x), oe = o+a.w; o < oe; ++o)
+		*o = w->window_id();
+    }
+    if (_owner.size() != owner.size()) {
+	_owner = move (owner);	// screen resized, everything will be redrawn
+	_uncovered.resize (scrsz);
 	return;
-    auto wpos (w->area().pos());
-    auto oci = _surface.iat (wpos);
-    size_t oskip = screen_info().size().w - w->area().w;
-
-    foreach (ici, w->surface()) {
-	assert (oci < _surface.end() && "position_window must clip each window to screen area");
-	// Skip writing if nothing changed
-	if (*oci != *ici) {
-	    auto curcell = *ici;
-
-	    // Convert GChars to ACS chars
-	    static constexpr const char c_acs_sym[] = "+,-.0`afghijklmnopqrstuvwxyz{|}~";
-	    static_assert (size(c_acs_sym)-1 == uint8_t(Drawlist::GChar::N), "c_acs_sym must parallel Drawlist::GChar");
-	    if (unsigned acsi = uint8_t(curcell.c.c[0]) - uint8_t(Drawlist::GChar::First); acsi < size(c_acs_sym)) {
-		curcell.c = c_acs_sym [acsi];	// ACS char, substitute
-		set_bit (curcell.attr, Surface::Attr::Altcharset);
-	    } else if (uint8_t(curcell.c.c[0]) < ' ') {
-		curcell.c = '?';		// unprintable character
-		set_bit (curcell.attr, Surface::Attr::Blink);
-		curcell.fg = IColor::Gray;
-		curcell.bg = IColor::Red;
-	    }
+    }
 
-	    // Collect numbers for the term sgr command
-	    uint8_t sgr[11], nsgr = 0;
-
-	    // {Off,On} sequences for attributes
-	    static const uint8_t c_attr_tseq[][2] = {
-		{22,1},	// Bold
-		{23,3},	// Italic
-		{24,4},	// Underline
-		{25,5},	// Blink
-		{27,7}	// Reverse
-	    };
-	    auto chattr = _lastcell.attr ^ curcell.attr;
-	    if (chattr)
-		for (auto a = 0u; a < size(c_attr_tseq); ++a)
-		    if (get_bit (chattr, a))
-			sgr[nsgr++] = c_attr_tseq[a][get_bit(curcell.attr,a)];
-
-	    // Set colors
-	    if (curcell.bg != _lastcell.bg) {
-		if (curcell.bg < 8)
-		    sgr[nsgr] = 40+curcell.bg;
-		else if (curcell.bg < 16)
-		    sgr[nsgr] = 100+curcell.bg;
-		else if (curcell.bg == IColor::Default)
-		    sgr[nsgr] = 49;
-		else {
-		    sgr[nsgr++] = 48;
-		    sgr[nsgr++] = 5;
-		    sgr[nsgr] = curcell.bg;
+    // Cells that changed owner are redrawn from the window now on top.
+    // A resized window is left alone, since its owner redraws it anyway.
+    for (auto w : _windows) {
+	auto& a = w->area();
+	auto wid = w->window_id();
+	auto gained = false;
+	for (dim_t y = 0; y < a.h; ++y) {
+	    auto i = (a.y+y)*scrsz.w+a.x;
+	    for (dim_t x = 0; x < a.w; ++x, ++i) {
+		if (owner[i] == wid && _owner[i] != wid) {
+		    w->damage_area (Rect (x, y, 1, 1));
+		    gained = true;
 		}
-		++nsgr;
 	    }
-	    if (curcell.fg != _lastcell.fg) {
-		if (curcell.fg < 8)
-		    sgr[nsgr] = 30+curcell.fg;
-		else if (curcell.fg < 16)
-		    sgr[nsgr] = 90+curcell.fg;
-		else if (curcell.fg == IColor::Default)
-		    sgr[nsgr] = 39;
-		else {
-		    sgr[nsgr++] = 38;
-		    sgr[nsgr++] = 5;
-		    sgr[nsgr] = curcell.fg;
-		}
-		++nsgr;
+	}
+	if (gained && w != resized)
+	    queue_draw (w);
+    }
+    // Cells not covered by any window are blanked
+    auto i = 0u;
+    for (dim_t y = 0; y < scrsz.h; ++y) {
+	for (dim_t x = 0; x < scrsz.w; ++x, ++i) {
+	    if (owner[i] == c_NoOwner && _owner[i] != c_NoOwner) {
+		_uncovered.add (y, x, x+1);
+		set_flag (f_Uncovered);
 	    }
+	}
+    }
+    if (flag (f_Uncovered))
+	_ptermo.wait_write (_ofd);
+    _owner = move (owner);
+}
 
-	    // Skip over unchanged content on the screen
-	    if (wpos != _curwpos) {
-		auto dpos = wpos - _curwpos;
-		if (!dpos.dy && dpos.dx > 0) {
-		    if (dpos.dx < 5 && ici-dpos.dx >= w->surface().begin()) {
-			// Rewrite unchanged chars if only a few and no attributes changed
-			for (; dpos.dx; --dpos.dx) {
-			    auto uici = ici-dpos.dx;
-			    if (uici->attr != _lastcell.attr || !uici->c.is_ascii())
-				break;
-			    _tout += uici->c.c[0];
-			}
-		    }
-		    if (dpos.dx > 0)
-			_tout.appendf (T_SKIP_N, dpos.dx);
-		} else
-		    _tout.appendf (T_MOVE_TO, wpos.y+1, wpos.x+1);
-		_curwpos = wpos;
-	    }
+//}}}-------------------------------------------------------------------
+//{{{ TerminalScreen::Surface diffing
+
+template <typename T>
+static dim_t first_changed_scalar (const T* a, const T* b, dim_t n)
+{
+    dim_t i = 0;
+    while (i < n && a[i] == b[i])
+	++i;
+    return i;
+}
+
+#if __x86_64__ || __i386__
+
+// Cells and compact codes are compared bytewise, two vectors at a time
+template <typename T>
+__attribute__((target("sse2")))
+static dim_t first_changed_sse2 (const T* a, const T* b, dim_t n)
+{
+    enum { c_PerVector = 16/sizeof(T) };
+    dim_t i = 0;
+    for (; i+2u*c_PerVector <= n; i += 2*c_PerVector) {
+	auto e0 = _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i*) &a[i]), _mm_loadu_si128 ((const __m128i*) &b[i]));
+	auto e1 = _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i*) &a[i+c_PerVector]), _mm_loadu_si128 ((const __m128i*) &b[i+c_PerVector]));
+	if (0xffff != _mm_movemask_epi8 (_mm_and_si128 (e0, e1)))
+	    break;
+    }
+    return i + first_changed_scalar (a+i, b+i, n-i);
+}
+
+template <typename T>
+__attribute__((target("avx2")))
+static dim_t first_changed_avx2 (const T* a, const T* b, dim_t n)
+{
+    enum { c_PerVector = 32/sizeof(T) };
+    dim_t i = 0;
+    for (; i+2u*c_PerVector <= n; i += 2*c_PerVector) {
+	auto e0 = _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i*) &a[i]), _mm256_loadu_si256 ((const __m256i*) &b[i]));
+	auto e1 = _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i*) &a[i+c_PerVector]), _mm256_loadu_si256 ((const __m256i*) &b[i+c_PerVector]));
+	if (uint32_t m = _mm256_movemask_epi8 (_mm256_and_si256 (e0, e1)); m != UINT32_MAX) {
+	    // Mismatch somewhere in these cells; find which one
+	    if (uint32_t m0 = _mm256_movemask_epi8 (e0); m0 != UINT32_MAX)
+		return i + __builtin_ctz (~m0)/sizeof(T);
+	    return i + c_PerVector + __builtin_ctz (~m)/sizeof(T);
+	}
+    }
+    return i + first_changed_scalar (a+i, b+i, n-i);
+}
+
+#endif
+
+template <typename T>
+using first_changed_fn_t = dim_t (*)(const T* a, const T* b, dim_t n);
+
+// Picks the widest vector unit available on this CPU
+template <typename T>
+static first_changed_fn_t<T> select_first_changed (void)
+{
+#if __x86_64__ || __i386__
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports ("avx2"))
+	return first_changed_avx2<T>;
+    if (__builtin_cpu_supports ("sse2"))
+	return first_changed_sse2<T>;
+#endif
+    return first_changed_scalar<T>;
+}
+static const auto s_first_changed = select_first_changed<TerminalScreen::Surface::Cell>();
+static const auto s_first_changed_codes = select_first_changed<TerminalScreen::Surface::code_t>();
+
+dim_t TerminalScreen::Surface::first_changed (const Cell* a, const Cell* b, dim_t n)
+    { return s_first_changed (a, b, n); }
+
+dim_t TerminalScreen::Surface::first_changed (const Point& a, const Surface& s, const Point& b, dim_t n) const
+{
+    assert (format() == s.format());
+    if (is_compact())
+	return s_first_changed_codes (&_codes[index (a.x,a.y)], &s._codes[s.index (b.x,b.y)], n);
+    return s_first_changed (&_cells[index (a.x,a.y)], &s._cells[s.index (b.x,b.y)], n);
+}
+
+dim_t TerminalScreen::Surface::first_unchanged (const Point& a, const Surface& s, const Point& b, dim_t n) const
+{
+    assert (format() == s.format());
+    if (!is_compact())
+	return first_unchanged (&_cells[index (a.x,a.y)], &s._cells[s.index (b.x,b.y)], n);
+    auto ac = &_codes[index (a.x,a.y)], bc = &s._codes[s.index (b.x,b.y)];
+    dim_t i = 0;
+    while (i < n && ac[i] != bc[i])
+	++i;
+    return i;
+}
+
+void TerminalScreen::Surface::scroll (dim_t top, dim_t bot, int n)
+{
+    // Rows [top,bot) move up by n, or down if n is negative
+    auto nc = dim_t(n < 0 ? -n : n)*_sz.w;
+    auto it = index (0, top), ib = index (0, bot);
+    assert (it + nc <= ib);
+    auto move_rows = [&](auto* c) {
+	if (n > 0)
+	    copy (c+it+nc, c+ib, c+it);
+	else
+	    copy_backward (c+it, c+ib-nc, c+ib);
+    };
+    if (is_compact())
+	move_rows (_codes.data());
+    else
+	move_rows (_cells.data());
+    // The exposed rows are blank
+    if (n > 0)
+	it = ib-nc;
+    for (auto y = it/_sz.w; y < (it+nc)/_sz.w; ++y)
+	for (dim_t x = 0; x < _sz.w; ++x)
+	    set_cell (x, y, default_cell());
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ TerminalScreen::Surface formats
+
+// Cells that do not fit in a compact code. The table is shared by all
+// surfaces and entries are never removed, one for each distinct cell
+// value drawn, so it grows until the index no longer fits in a code.
+class EscapedCells {
+public:
+    using Cell = TerminalScreen::Surface::Cell;
+    enum : uint32_t { MaxCells = 1u << 24, NoIndex = UINT32_MAX };
+public:
+			EscapedCells (void)	:_cells(),_index() {}
+    uint32_t		intern (const Cell& c);
+    auto&		operator[] (uint32_t i) const	{ return _cells[i]; }
+    bool		full (void) const		{ return _cells.size() >= MaxCells; }
+private:
+    static uint32_t	hash (const Cell& c)	{ return (*pointer_cast<uint64_t>(&c) * 0x9e3779b97f4a7c15) >> 32; }
+    void		insert (uint32_t i);
+private:
+    vector<Cell>	_cells;
+    vector<uint32_t>	_index;	// Open addressed, with _cells index+1, or 0 if empty
+};
+
+void EscapedCells::insert (uint32_t i)
+{
+    for (auto h = hash (_cells[i]);; ++h) {
+	if (auto& e = _index [h & (_index.size()-1)]; !e) {
+	    e = i+1;
+	    break;
+	}
+    }
+}
+
+uint32_t EscapedCells::intern (const Cell& c)
+{
+    // Kept at most half full, so that probe sequences are short
+    if (_index.size() < 2*(_cells.size()+1)) {
+	_index.resize (max (_index.size()*2, size_t(64)));
+	fill (_index, 0);
+	for (auto i = 0u; i < _cells.size(); ++i)
+	    insert (i);
+    }
+    for (auto h = hash (c);; ++h) {
+	auto& e = _index [h & (_index.size()-1)];
+	if (e && _cells[e-1] == c)
+	    return e-1;
+	if (!e) {
+	    if (full())
+		return NoIndex;	// full, cells are never evicted
+	    _cells.push_back (c);
+	    e = _cells.size();
+	    return e-1;
+	}
+    }
+}
+
+static EscapedCells s_escaped_cells;
+
+auto TerminalScreen::Surface::escape (const Cell& c) -> code_t
+{
+    if (auto i = s_escaped_cells.intern (c); i != EscapedCells::NoIndex)
+	return c_Escaped | i << 8;
+    // Shown as '?' until the screen switches to the full format
+    return uint8_t('?') | c.attr << 8 | c.fg << 16 | code_t(c.bg) << 24;
+}
+
+bool TerminalScreen::Surface::escapes_full (void)
+    { return s_escaped_cells.full(); }
+
+auto TerminalScreen::Surface::unescape (code_t v) -> Cell
+    { return s_escaped_cells [v >> 8]; }
+
+void TerminalScreen::Surface::set_format (Format f)
+{
+    if (_fmt == f)
+	return;
+    _fmt = f;
+    _cells.clear();
+    _codes.clear();
+    resize (_sz);
+    clear();
+}
+
+void TerminalScreen::Surface::resize (const Size& sz)
+{
+    _sz = sz;
+    if (is_compact())
+	_codes.resize (_sz.w*_sz.h);
+    else
+	_cells.resize (_sz.w*_sz.h);
+}
+
+void TerminalScreen::Surface::clear (void)
+{
+    if (is_compact())
+	fill (_codes, encode (default_cell()));
+    else
+	fill (_cells, default_cell());
+}
+
+void TerminalScreen::Surface::copy_cells (dim_t x, dim_t y, const Surface& s, dim_t sx, dim_t sy, dim_t n)
+{
+    assert (format() == s.format());
+    if (is_compact())
+	copy_n (&s._codes[s.index (sx,sy)], n, &_codes[index (x,y)]);
+    else
+	copy_n (&s._cells[s.index (sx,sy)], n, &_cells[index (x,y)]);
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ TerminalScreen::Encoder
+
+// A precomputed sequence, copied whole and advanced by n
+struct SgrSeq {
+    char	s [11];
+    uint8_t	n;
+};
+
+// {Off,On} SGR parameters for attributes
+static constexpr const uint8_t c_attr_tseq[][2] = {
+    {22,1},	// Bold
+    {23,3},	// Italic
+    {24,4},	// Underline
+    {25,5},	// Blink
+    {27,7}	// Reverse
+};
+static_assert (size(c_attr_tseq) == TerminalScreen::Surface::Attr::Altcharset, "c_attr_tseq must contain sequences for each Attr");
+
+// DEC graphics chars for GChars, written in altcharset
+static constexpr const char c_acs_sym[] = "+,-.0`afghijklmnopqrstuvwxyz{|}~";
+static_assert (size(c_acs_sym)-1 == uint8_t(Drawlist::GChar::N), "c_acs_sym must parallel Drawlist::GChar");
+
+// SGR parameters for every attribute and color transition
+struct SgrTables {
+    SgrSeq	attr [TerminalScreen::Surface::Attr::Altcharset][2];
+    SgrSeq	fg [256];
+    SgrSeq	bg [256];
+    char	digits [200];
+public:
+    constexpr SgrTables (void) : attr{},fg{},bg{},digits{} {
+	for (auto a = 0u; a < size(attr); ++a)
+	    for (auto v = 0u; v < 2; ++v)
+		append (attr[a][v], c_attr_tseq[a][v]);
+	for (auto c = 0u; c < size(fg); ++c) {
+	    color (fg[c], c, 30);
+	    color (bg[c], c, 40);
+	}
+	for (auto i = 0u; i < size(digits)/2; ++i) {
+	    digits[2*i] = '0'+i/10;
+	    digits[2*i+1] = '0'+i%10;
+	}
+    }
+private:
+    static constexpr void append (SgrSeq& s, unsigned v) {
+	if (v >= 100)
+	    s.s[s.n++] = '0'+v/100;
+	if (v >= 10)
+	    s.s[s.n++] = '0'+v/10%10;
+	s.s[s.n++] = '0'+v%10;
+	s.s[s.n++] = ';';
+    }
+    static constexpr void color (SgrSeq& s, unsigned c, unsigned base) {
+	if (c < 8)
+	    append (s, base+c);
+	else if (c < 16)
+	    append (s, base+60+c-8);
+	else if (c == IColor::Default)
+	    append (s, base+9);
+	else {
+	    append (s, base+8);
+	    append (s, 5);
+	    append (s, c);
+	}
+    }
+};
+static constexpr const SgrTables c_sgr;
+
+inline static char* write_seq (char* o, const SgrSeq& s)
+{
+    // Sequences are copied whole, the caller reserves enough space for the overrun
+    __builtin_memcpy (o, s.s, sizeof(s.s));
+    return o + s.n;
+}
+
+char* TerminalScreen::Encoder::write_uint (char* o, unsigned n)
+{
+    auto e = o + 1 + (n >= 10) + (n >= 100) + (n >= 1000) + (n >= 10000);
+    auto p = e;
+    for (; n >= 100; n /= 100) {
+	p -= 2;
+	__builtin_memcpy (p, &c_sgr.digits[2*(n%100)], 2);
+    }
+    if (n >= 10)
+	__builtin_memcpy (p-2, &c_sgr.digits[2*n], 2);
+    else
+	p[-1] = '0'+n;
+    return e;
+}
+
+// Length of a number written by write_uint
+static constexpr unsigned uint_len (unsigned n)
+    { return 1 + (n >= 10) + (n >= 100) + (n >= 1000) + (n >= 10000); }
+
+// Length of a CSI sequence with one parameter, omitted when 1
+static constexpr unsigned csi_len (unsigned n)
+    { return strlen(T_CSI) + 1 + (n != 1 ? uint_len(n) : 0); }
+
+// Length of a CUP sequence, the column omitted when first
+static constexpr unsigned cup_len (const Point& p)
+    { return p.x ? strlen(T_CSI) + uint_len(p.y+1) + 1 + uint_len(p.x+1) + 1 : csi_len (p.y+1); }
+
+char* TerminalScreen::Encoder::write_csi (char* o, unsigned n, char f)
+{
+    *o++ = '\033';
+    *o++ = '[';
+    if (n != 1)
+	o = write_uint (o, n);
+    *o++ = f;
+    return o;
+}
+
+char* TerminalScreen::Encoder::move_to (char* o, const Point& p)
+{
+    if (!p.x)
+	o = write_csi (o, p.y+1, 'H');
+    else {
+	*o++ = '\033';
+	*o++ = '[';
+	o = write_uint (o, p.y+1);
+	*o++ = ';';
+	o = write_uint (o, p.x+1);
+	*o++ = 'H';
+    }
+    _pos = p;
+    return o;
+}
+
+// Unchanged cells can be rewritten to move right if they are plain
+// ASCII and use the current attributes.
+bool TerminalScreen::Encoder::reprintable (const Surface& scr, dim_t x, dim_t y, dim_t n) const
+{
+    for (auto xe = x+n; x < xe; ++x)
+	if (auto c = scr.cell (x, y); !c.same_colors (_lastcell) || !c.c.is_ascii())
+	    return false;
+    return true;
+}
+
+auto TerminalScreen::Encoder::hmotion (dim_t x, const Point& p, const Surface& scr) const -> Motion
+{
+    Motion m = { 0, 0 };
+    if (x == p.x)
+	return m;
+    m.cost = NoMotion;
+    if (p.x > x) {
+	unsigned n = p.x - x;
+	m.consider (has (Cap::CursorRight), csi_len (n), 'C');
+	m.consider (n < m.cost && reprintable (scr, x, p.y, n), n, 'r');
+    } else {
+	unsigned n = x - p.x;
+	m.consider (has (Cap::CursorLeft), csi_len (n), 'D');
+	m.consider (true, n, '\b');
+    }
+    m.consider (has (Cap::ColumnAddress), csi_len (p.x+1), 'G');
+    return m;
+}
+
+auto TerminalScreen::Encoder::vmotion (dim_t y, const Point& p, bool linefeed) const -> Motion
+{
+    Motion m = { 0, 0 };
+    if (y == p.y)
+	return m;
+    m.cost = NoMotion;
+    if (p.y > y) {
+	unsigned n = p.y - y;
+	m.consider (has (Cap::CursorDown), csi_len (n), 'B');
+	m.consider (linefeed, n, '\n');
+    } else
+	m.consider (has (Cap::CursorUp), csi_len (y - p.y), 'A');
+    m.consider (has (Cap::RowAddress), csi_len (p.y+1), 'd');
+    return m;
+}
+
+char* TerminalScreen::Encoder::write_motion (char* o, const Motion& m, dim_t from, dim_t to, const Surface& scr, dim_t y) const
+{
+    switch (m.how) {
+	case 0:		break;
+	case 'A': case 'B': case 'C': case 'D':
+			o = write_csi (o, from < to ? to-from : from-to, m.how); break;
+	case 'G': case 'd':
+			o = write_csi (o, to+1, m.how); break;
+	case 'r':	for (auto x = from; x < to; ++x)
+			    *o++ = scr.cell (x, y).c.c[0];
+			break;
+	default:	// \b and \n
+			__builtin_memset (o, m.how, m.cost);
+			o += m.cost;
+			break;
+    }
+    return o;
+}
+
+char* TerminalScreen::Encoder::move_to (char* o, const Point& p, const Surface& scr)
+{
+    // Picks the shortest of CUP, relative or absolute moves along each
+    // axis, a CR first, and autowrap, like ncurses mvcur does.
+    if (p == _pos)
+	return o;
+    ++_nmoves;
+    enum { Absolute, Relative, Return, Wrap } plan = Absolute;
+    auto cost = cup_len (p);
+    Motion v = {}, h = {};
+
+    // After writing the last column, the cursor waits to wrap until the
+    // next char is written, and relative moves are not reliable.
+    auto pending = _pos.x >= _scrsz.w;
+    if (!pending) {
+	// Linefeeds do not move to the first column without a CR, unless already there
+	auto rv = vmotion (_pos.y, p, !_pos.x);
+	auto rh = hmotion (_pos.x, p, scr);
+	if (rv.cost + rh.cost < cost) {
+	    cost = rv.cost + rh.cost;
+	    plan = Relative;
+	    v = rv; h = rh;
+	}
+    } else if (has (Cap::AutoWrap) && p.y == _pos.y+1 && p.x > 0 && unsigned(p.x) < cost && reprintable (scr, 0, p.y, p.x)) {
+	// The wrap happens when the next char is written, a reprinted one.
+	// Without one, the cursor would still be waiting on the last column
+	// for an erase or the caret, so CR is used to get to the first.
+	cost = p.x;
+	plan = Wrap;
+	h = Motion { cost, 'r' };
+    }
+    if ((!pending && _pos.x) || (pending && has (Cap::AutoWrap))) {
+	auto rv = vmotion (_pos.y, p, true);
+	auto rh = hmotion (0, p, scr);
+	if (1 + rv.cost + rh.cost < cost) {
+	    plan = Return;
+	    v = rv; h = rh;
+	}
+    }
+
+    if (plan == Absolute)
+	return move_to (o, p);
+    if (plan == Return) {
+	*o++ = '\r';
+	_pos.x = 0;
+    } else if (plan == Wrap)
+	_pos.x = 0;
+    o = write_motion (o, v, _pos.y, p.y, scr, p.y);
+    o = write_motion (o, h, _pos.x, p.x, scr, p.y);
+    _pos = p;
+    return o;
+}
+
+char* TerminalScreen::Encoder::write_cell (char* o, Cell c)
+{
+    // Convert GChars to ACS chars
+    if (unsigned acsi = uint8_t(c.c.c[0]) - uint8_t(Drawlist::GChar::First); acsi < size(c_acs_sym)) {
+	c.c = c_acs_sym [acsi];	// ACS char, substitute
+	set_bit (c.attr, Surface::Attr::Altcharset);
+    } else if (c.c.is_wide_tail())
+	c.c = ' ';		// right of a wide char written elsewhere
+    else if (uint8_t(c.c.c[0]) < ' ') {
+	c.c = '?';		// unprintable character
+	set_bit (c.attr, Surface::Attr::Blink);
+	c.set_fgc (IColor::Gray);
+	c.set_bgc (IColor::Red);
+    }
+    o = write_attrs (o, c);
+
+    // Write the character, with any combining marks, at most 4 bytes
+    __builtin_memcpy (o, c.c.c, sizeof(c.c.c));
+    o += c.c.size();
+
+    // Adjust tracking variables. Wide chars start at U+1100, which
+    // is the first with a 0xe1 lead byte, so ASCII is never decoded.
+    auto cw = 1u;
+    if (uint8_t(c.c.c[0]) >= 0xe1 && char_width (*utf8::in (c.c.c)) > 1)
+	cw = 2;
+    if ((_pos.x += cw) > _scrsz.w) {
+	_pos.x = 0;
+	if (_pos.y < _scrsz.h)
+	    ++_pos.y;
+    }
+    return o;
+}
+
+char* TerminalScreen::Encoder::write_attrs (char* o, const Cell& c)
+{
+    // Write the sgr sequence, dropping the CSI if no parameters are needed
+    auto sgr = o;
+    *o++ = '\033';
+    *o++ = '[';
+    auto chattr = _lastcell.attr ^ c.attr;
+    if (chattr)
+	for (auto a = 0u; a < size(c_sgr.attr); ++a)
+	    if (get_bit (chattr, a))
+		o = write_seq (o, c_sgr.attr[a][get_bit(c.attr,a)]);
+    if (auto bg = c.bgc(); bg != _lastcell.bgc())
+	o = bg < RgbTable::First ? write_seq (o, c_sgr.bg[bg]) : write_color (o, bg, 48);
+    if (auto fg = c.fgc(); fg != _lastcell.fgc())
+	o = fg < RgbTable::First ? write_seq (o, c_sgr.fg[fg]) : write_color (o, fg, 38);
+    if (o == sgr+2)
+	o = sgr;
+    else {
+	o[-1] = 'm';
+	++_nsgrs;
+    }
+
+    // Enable (14) or disable (15) altcharset if changed
+    if (get_bit (chattr, Surface::Attr::Altcharset))
+	*o++ = char(15-get_bit (c.attr, Surface::Attr::Altcharset));
+    _lastcell = c;
+    return o;
+}
+
+// Writes n copies of c on the current row. Blank runs are erased, and
+// runs of other single byte chars are repeated, when the terminal has
+// the sequence and it is shorter. Erasing leaves the cursor in place.
+char* TerminalScreen::Encoder::write_run (char* o, const Cell& c, dim_t n)
+{
+    assert (_pos.x + n <= _scrsz.w && "runs must not wrap");
+    // Erased cells have no attributes, and the default background
+    // unless the terminal erases with the current one.
+    static constexpr const uint8_t c_EraseAttrs = 1u << Surface::Attr::Bold | 1u << Surface::Attr::Italic;
+    if (c.c == Surface::default_cell().c && !(c.attr & ~c_EraseAttrs) && (has (Cap::BackColorErase) || c.bgc() == IColor::Default)) {
+	// A motion to the cell after the run usually follows
+	if (has (Cap::ClearToEol) && _pos.x + n == _scrsz.w && csi_len (1) < n)
+	    return write_csi (write_attrs (o, c), 1, 'K');
+	if (has (Cap::EraseChars) && 2*csi_len (n) < n)
+	    return write_csi (write_attrs (o, c), n, 'X');
+    }
+    o = write_cell (o, c);
+    // The repeated char must be the one just written, one byte wide
+    auto onebyte = !c.c.c[1] && (c.c.is_ascii() || unsigned(uint8_t(c.c.c[0]) - uint8_t(Drawlist::GChar::First)) < size(c_acs_sym));
+    if (has (Cap::RepeatChar) && onebyte && csi_len (n-1) < unsigned(n-1)) {
+	o = write_csi (o, n-1, 'b');
+	_pos.x += n-1;
+    } else {
+	for (auto i = 1u; i < n; ++i)
+	    o = write_cell (o, c);
+    }
+    return o;
+}
+
+char* TerminalScreen::Encoder::write_color (char* o, uint16_t c, unsigned base) const
+{
+    // 38;2;r;g;b or 48;2;r;g;b
+    auto rgb = _rgb[c];
+    *o++ = '0'+base/10;
+    *o++ = '8';
+    *o++ = ';';
+    *o++ = '2';
+    *o++ = ';';
+    for (auto i = 0u; i < 3; ++i, rgb >>= 8) {
+	o = write_uint (o, uint8_t(rgb));
+	*o++ = ';';
+    }
+    return o;
+}
+
+char* TerminalScreen::Encoder::scroll (char* o, dim_t top, dim_t bot, int n)
+{
+    // Exposed lines are cleared with the current background
+    if (!_lastcell.same_colors (Surface::default_cell())) {
+	__builtin_memcpy (o, T_SET_DEFAULT_ATTRS, strlen(T_SET_DEFAULT_ATTRS));
+	o += strlen(T_SET_DEFAULT_ATTRS);
+	_lastcell = Surface::default_cell();
+    }
+    // Set the scroll region and delete or insert lines at its top.
+    // IL and DL are used instead of SU and SD for the linux console.
+    *o++ = '\033';
+    *o++ = '[';
+    o = write_uint (o, top+1);
+    *o++ = ';';
+    o = write_uint (o, bot);
+    *o++ = 'r';
+    o = move_to (o, Point (0, top));
+    *o++ = '\033';
+    *o++ = '[';
+    o = write_uint (o, n < 0 ? -n : n);
+    *o++ = n < 0 ? 'L' : 'M';
+    // Resetting the scroll region moves the cursor to the origin
+    __builtin_memcpy (o, T_RESET_SCROLL_REGION, strlen(T_RESET_SCROLL_REGION));
+    o += strlen(T_RESET_SCROLL_REGION);
+    _pos = Point();
+    return o;
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ TerminalScreen::RgbTable
+
+auto TerminalScreen::RgbTable::intern (color_t c) -> code_t
+{
+    c &= RGBA (UINT8_MAX, UINT8_MAX, UINT8_MAX, 0);	// alpha is not used in terminals
+    if (_slots.empty()) {
+	_slots.resize (NSlots);
+	fill (_slots, 0);
+    }
+    for (auto h = (c*0x9e3779b1u) >> (32-SlotBits);; h = (h+1) % NSlots) {
+	auto& s = _slots[h];
+	if (s) {
+	    if (_rgb[s-First] == c)
+		return s;
+	} else if (_rgb.size() < Last-First) {
+	    _rgb.push_back (c);
+	    return s = First + _rgb.size()-1;
+	} else
+	    return 0;	// full, colors are never evicted
+    }
+}
+
+// Nearest color in the xterm 6x6x6 cube or the gray ramp
+static icolor_t nearest_palette_color (color_t c)
+{
+    static constexpr auto cube_level = [](int v) { return v < 48 ? 0 : v < 115 ? 1 : (v-35)/40; };
+    static constexpr auto cube_value = [](int l) { return l ? 55+40*l : 0; };
+    static constexpr auto dist2 = [](int r, int g, int b, int vr, int vg, int vb)
+	{ return (r-vr)*(r-vr)+(g-vg)*(g-vg)+(b-vb)*(b-vb); };
+    int r = uint8_t(c), g = uint8_t(c>>8), b = uint8_t(c>>16);
+    auto lr = cube_level(r), lg = cube_level(g), lb = cube_level(b);
+    auto gl = min (max ((r+g+b)/3-3, 0)/10, 23), gv = 8+10*gl;
+    if (dist2 (r,g,b, gv,gv,gv) < dist2 (r,g,b, cube_value(lr),cube_value(lg),cube_value(lb)))
+	return IColor::Gray0+gl;
+    auto ci = 16+36*lr+6*lg+lb;
+    return ci == IColor::Default ? IColor::Black : ci;	// cube black shares the index with Default
+}
+
+auto TerminalScreen::color_code (color_t c) -> RgbTable::code_t
+{
+    if (_scrinfo.depth() > 8)
+	if (auto code = _enc.colors().intern (c); code)
+	    return code;
+    return nearest_palette_color (c);
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ TerminalScreen::Recorder
+
+bool TerminalScreen::Recorder::open (const char* filename)
+{
+    close();
+    if (0 > (_fd = ::open (filename, O_WRONLY| O_CREAT| O_TRUNC| O_CLOEXEC, 0644)))
+	return false;
+    _start = nstime();
+    write_all (c_Magic, sizeof(c_Magic));
+    return is_open();
+}
+
+void TerminalScreen::Recorder::close (void)
+{
+    if (_fd >= 0)
+	::close (_fd);
+    _fd = -1;
+}
+
+void TerminalScreen::Recorder::write_all (const void* p, size_t n)
+{
+    for (auto d = static_cast<const char*>(p); n && is_open();) {
+	auto bw = ::write (_fd, d, n);
+	if (bw > 0) {
+	    d += bw;
+	    n -= bw;
+	} else if (bw < 0 && errno == EINTR)
+	    continue;
+	else
+	    close();
+    }
+}
+
+// Records the first n bytes in iov
+void TerminalScreen::Recorder::write (Type t, uint16_t id, const iovec* iov, unsigned niov, size_t n)
+{
+    if (!is_open())
+	return;
+    Header h = { nstime() - _start, uint32_t(n), t, 0, id };
+    write_all (&h, sizeof(h));
+    for (auto i = 0u; i < niov && n; ++i) {
+	auto sz = min (iov[i].iov_len, n);
+	write_all (iov[i].iov_base, sz);
+	n -= sz;
+    }
+}
 
-	    // Write the sgr sequence
-	    if (nsgr > 0) {
-		_tout += T_CSI;
-		for (auto i = 0u; i < nsgr; ++i)
-		    _tout.appendf ("%hhu;", sgr[i]);
-		_tout.back() = 'm';
+bool TerminalScreen::record (const char* filename)
+{
+    if (!_rec.open (filename))
+	return false;
+    // Before ui_mode, the size is recorded when it is first known
+    if (auto sz = _scrinfo.size(); sz.w)
+	_rec.write (Recorder::Type::Screen, 0, &sz, sizeof(sz));
+    return true;
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ TerminalScreen::Output
+
+char* TerminalScreen::Output::reserve (size_t n)
+{
+    // Chunks holding data are never reallocated, so start a new one
+    if (_chunks.empty() || _chunks.back().capacity() - _chunks.back().size() < n) {
+	auto& c = _chunks.emplace_back (move (_spare));
+	c.reserve (max (n, size_t(ChunkSize)));
+    }
+    return _chunks.back().end();
+}
+
+void TerminalScreen::Output::consume (size_t n)
+{
+    _size -= n;
+    for (n += _head; !_chunks.empty() && n >= _chunks[0].size(); _chunks.erase (_chunks.begin())) {
+	n -= _chunks[0].size();
+	_spare = move (_chunks[0]);
+	_spare.clear();
+    }
+    _head = n;
+}
+
+ssize_t TerminalScreen::Output::write (fd_t fd, Recorder& rec)
+{
+    if (_chunks.empty())
+	return 0;
+    enum { MaxIov = 16 };
+    iovec iov [MaxIov];
+    auto niov = min (_chunks.size(), size_t(MaxIov));
+    for (auto i = 0u; i < niov; ++i) {
+	iov[i].iov_base = _chunks[i].data();
+	iov[i].iov_len = _chunks[i].size();
+    }
+    iov[0].iov_base = _chunks[0].data() + _head;
+    iov[0].iov_len -= _head;
+    auto bw = writev (fd, iov, niov);
+    if (bw > 0) {
+	rec.write (Recorder::Type::Output, 0, iov, niov, bw);
+	consume (bw);
+    }
+    return bw;
+}
+
+void TerminalScreen::Output::write (Emulator& vt, Recorder& rec)
+{
+    for (auto i = 0u; i < _chunks.size(); ++i) {
+	auto skip = i ? 0 : _head;
+	vt.write (_chunks[i].data() + skip, _chunks[i].size() - skip);
+	rec.write (Recorder::Type::Output, 0, _chunks[i].data() + skip, _chunks[i].size() - skip);
+    }
+    consume (_size);
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ TerminalScreen::Emulator
+
+TerminalScreen::Emulator::Emulator (void)
+:_scr()
+,_pen (Surface::default_cell())
+,_pos()
+,_top()
+,_bot()
+,_rgb()
+,_nbytes()
+,_nseqs()
+,_last (' ')
+,_uc()
+,_ucn()
+,_state (State::Ground)
+,_shifted()
+,_mark()
+,_nparams()
+,_params{}
+{
+}
+
+void TerminalScreen::Emulator::resize (const Size& sz)
+{
+    _scr.resize (sz);
+    _scr.clear();
+    _pos = Point();
+    _top = 0;
+    _bot = sz.h;
+}
+
+void TerminalScreen::Emulator::write (const char* s, size_t n)
+{
+    _nbytes += n;
+    for (auto i = 0u; i < n; ++i) {
+	auto c = s[i];
+	auto b = uint8_t(c);
+	if (_state == State::Esc) {
+	    _state = State::Ground;
+	    if (c == '[') {
+		_state = State::Csi;
+		_nparams = 0;
+		_mark = 0;
+	    } else if (c == '(' || c == ')')
+		_state = State::Charset;
+	    else	// other two-char sequences change nothing here
+		++_nseqs;
+	} else if (_state == State::Charset) {
+	    // Designations are assumed to be those in T_ALTCHARSET_ENABLE
+	    _state = State::Ground;
+	    ++_nseqs;
+	} else if (_state == State::Csi) {
+	    if (c >= '0' && c <= '9') {
+		if (!_nparams)
+		    _params[_nparams++] = 0;
+		auto& p = _params[_nparams-1];
+		p = min (p*10u + (c-'0'), unsigned(UINT16_MAX));
+	    } else if (c == ';') {
+		if (!_nparams)
+		    _params[_nparams++] = 0;
+		if (_nparams < size(_params))
+		    _params[_nparams++] = 0;
+	    } else if (b >= ' ' && b < '@')
+		_mark = c;
+	    else {
+		_state = State::Ground;
+		++_nseqs;
+		if (!_mark)	// private modes and queries change nothing on screen
+		    csi (c);
+	    }
+	} else if (b < ' ' || b == 0x7f)
+	    control (c);
+	else if (b < 0x80)
+	    print (c);
+	else if (b < 0xc0) {	// continuation byte
+	    if (_ucn) {
+		_uc = _uc << 6 | (b & 0x3f);
+		if (!--_ucn)
+		    print (_uc);
 	    }
+	} else {
+	    _ucn = utf8::ibytes (c) - 1;
+	    _uc = b & (0x3f >> _ucn);
+	}
+    }
+}
+
+void TerminalScreen::Emulator::control (char c)
+{
+    if (c == '\033')
+	_state = State::Esc;
+    else if (c == '\r')
+	_pos.x = 0;
+    else if (c == '\n')
+	linefeed();
+    else if (c == '\b') {
+	_pos.x = min (_pos.x, coord_t(_scr.size().w-1));
+	if (_pos.x)
+	    --_pos.x;
+    } else if (c == '\016')
+	_shifted = true;
+    else if (c == '\017')
+	_shifted = false;
+}
+
+void TerminalScreen::Emulator::linefeed (void)
+{
+    _pos.x = min (_pos.x, coord_t(_scr.size().w-1));
+    if (_pos.y+1 == _bot)
+	_scr.scroll (_top, _bot, 1);
+    else if (_pos.y+1 < _scr.size().h)
+	++_pos.y;
+}
 
-	    // Enable (14) or disable (15) altcharset if changed
-	    if (get_bit (chattr, Surface::Attr::Altcharset))
-		_tout += char(15-get_bit (curcell.attr, Surface::Attr::Altcharset));
+void TerminalScreen::Emulator::print (char32_t c)
+{
+    _last = c;
+    auto w = char_width (c);
+    if (!w) {	// combining marks join the char before the cursor
+	if (_pos.x) {
+	    auto o = _scr.iat (_pos.x-1, _pos.y);
+	    if (o->c.is_wide_tail() && _pos.x > 1)
+		--o;
+	    o->c.append (c);
+	}
+	return;
+    }
+    // Wraps when pending, or when a wide char does not fit
+    if (_pos.x+w > _scr.size().w) {
+	_pos.x = 0;
+	linefeed();
+    }
+    auto o = _scr.iat (_pos);
+    *o = _pen;
+    o->c = c;
+    if (_shifted && c < 0x80)	// stored as the GChar, like the drawn surface
+	if (auto a = strchr (c_acs_sym, c); a)
+	    o->c = char32_t(uint8_t(Drawlist::GChar::First) + (a - c_acs_sym));
+    if (w > 1) {
+	o[1] = _pen;
+	o[1].c.set_wide_tail();
+    }
+    _pos.x += w;
+}
 
-	    // Write the character
-	    _tout += curcell.c.c;
+void TerminalScreen::Emulator::erase (dim_t x, dim_t y, size_t n)
+{
+    // Erased cells take the current background, as on bce terminals
+    auto blank = Surface::default_cell();
+    blank.set_bgc (_pen.bgc());
+    for (auto o = _scr.iat (x, y), oe = o+n; o < oe; ++o)
+	*o = blank;
+}
 
-	    // Adjust tracking variables
-	    if (++_curwpos.x > _scrinfo.size().w) {
-		_curwpos.x = 0;
-		if (_curwpos.y < _scrinfo.size().h)
-		    ++_curwpos.y;
+void TerminalScreen::Emulator::csi (char f)
+{
+    // Motion cancels a pending wrap
+    int w = _scr.size().w, h = _scr.size().h;
+    int x = min (int(_pos.x), w-1), y = _pos.y, n = param (0);
+    switch (f) {
+	case 'A': y -= n; break;
+	case 'B': y += n; break;
+	case 'C': x += n; break;
+	case 'D': x -= n; break;
+	case 'G': x = n-1; break;
+	case 'd': y = n-1; break;
+	case 'H':
+	case 'f': y = n-1; x = param(1)-1; break;
+	case 'K': erase (x, y, w-x); break;
+	case 'X': erase (x, y, min (n, w-x)); break;
+	case 'J':	// rows are contiguous, so this erases to the end of the screen
+	    if (param (0,0))
+		erase (0, 0, w*h);
+	    else
+		erase (x, y, w*(h-y)-x);
+	    break;
+	case 'L':	// IL and DL only work inside the scroll region
+	case 'M':
+	    if (y >= _top && y < _bot)
+		_scr.scroll (y, _bot, f == 'L' ? -min (n, _bot-y) : min (n, _bot-y));
+	    x = 0;
+	    break;
+	case 'r':
+	    _top = min (param(0), unsigned(h))-1;
+	    _bot = min (param(1,h), unsigned(h));
+	    if (_top >= _bot) {
+		_top = 0;
+		_bot = h;
 	    }
-	    _lastcell = curcell;
-	    *oci = *ici;
+	    x = y = 0;
+	    break;
+	case 'b':
+	    while (n--)
+		print (_last);
+	    return;
+	case 'm': return sgr();
+	default: return;
+    }
+    _pos.x = min (max (x, 0), w-1);
+    _pos.y = min (max (y, 0), h-1);
+}
+
+void TerminalScreen::Emulator::sgr (void)
+{
+    if (!_nparams)
+	_params[_nparams++] = 0;
+    for (auto i = 0u; i < _nparams; ++i) {
+	auto p = _params[i];
+	if (!p)
+	    _pen = Surface::default_cell();
+	else if (p >= 30 && p <= 37)
+	    _pen.set_fgc (p-30);
+	else if (p >= 90 && p <= 97)
+	    _pen.set_fgc (p-90+8);
+	else if (p == 39)
+	    _pen.set_fgc (IColor::Default);
+	else if (p >= 40 && p <= 47)
+	    _pen.set_bgc (p-40);
+	else if (p >= 100 && p <= 107)
+	    _pen.set_bgc (p-100+8);
+	else if (p == 49)
+	    _pen.set_bgc (IColor::Default);
+	else if (p == 38 || p == 48) {
+	    uint16_t c;
+	    if (i+2 < _nparams && _params[i+1] == 5) {
+		c = _params[i+2];
+		i += 2;
+	    } else if (i+4 < _nparams && _params[i+1] == 2) {
+		c = _rgb.intern (RGB (_params[i+2], _params[i+3], _params[i+4]));
+		i += 4;
+	    } else
+		break;
+	    if (p == 38)
+		_pen.set_fgc (c);
+	    else
+		_pen.set_bgc (c);
+	} else {
+	    for (auto a = 0u; a < size(c_attr_tseq); ++a)
+		for (auto v = 0u; v < 2; ++v)
+		    if (p == c_attr_tseq[a][v])
+			set_bit (_pen.attr, a, v);
+	}
+    }
+}
+
+string TerminalScreen::Emulator::text (void) const
+{
+    // DEC graphics are shown as the Unicode chars terminals draw for them
+    static constexpr const char32_t c_acs_unicode[] = {
+	0x2192, 0x2190, 0x2191, 0x2193, 0x2588, 0x25c6, 0x2592, 0x00b0,
+	0x00b1, 0x2591, 0x240b, 0x2518, 0x2510, 0x250c, 0x2514, 0x253c,
+	0x23ba, 0x23bb, 0x2500, 0x23bc, 0x23bd, 0x251c, 0x2524, 0x2534,
+	0x252c, 0x2502, 0x2264, 0x2265, 0x03c0, 0x2260, 0x00a3, 0x00b7
+    };
+    static_assert (size(c_acs_unicode) == size(c_acs_sym)-1, "c_acs_unicode must parallel c_acs_sym");
+    string t;
+    for (dim_t y = 0; y < _scr.size().h; ++y) {
+	auto lend = t.size();	// trailing blanks are dropped
+	for (auto c = _scr.iat (0, y), ce = c+_scr.size().w; c < ce; ++c) {
+	    auto ch = c->c;
+	    if (ch.is_wide_tail())
+		continue;
+	    if (unsigned acsi = uint8_t(ch.c[0]) - uint8_t(Drawlist::GChar::First); acsi < size(c_acs_unicode))
+		ch = c_acs_unicode [acsi];
+	    else if (uint8_t(ch.c[0]) < ' ')
+		ch = '?';
+	    t.append (ch.c, ch.size());
+	    if (ch.c[0] != ' ')
+		lend = t.size();
 	}
+	t.shrink (lend);
+	t += '\n';
+    }
+    return t;
+}
 
-	// Advance output and position
-	++oci;
-	if (++wpos.x >= w->area().x + w->area().w) {
-	    wpos.x = w->area().x;
-	    ++wpos.y;
-	    oci += oskip;
+//}}}-------------------------------------------------------------------
+//{{{ TerminalScreen draw_window
+
+// Scrolling is only worth the escape sequences if it saves this many rows
+static constexpr const dim_t c_MinScrollRows = 3;
+
+static constexpr uint64_t hash_cell (uint64_t h, uint64_t c)
+    { h = (h ^ c) * 0x100000001b3; return h ^ (h >> 29); }
+
+static uint64_t hash_row (const TerminalScreen::Surface& s, dim_t y)
+{
+    uint64_t h = 0xcbf29ce484222325;
+    for (dim_t x = 0; x < s.size().w; ++x) {
+	auto c = s.cell (x, y);
+	h = hash_cell (h, *pointer_cast<uint64_t>(&c));
+    }
+    return h;
+}
+
+Rect TerminalScreen::scroll_window (const TerminalScreenWindow* w)
+{
+    // Terminals scroll whole lines, so only full-width windows qualify,
+    // and only when no other window is on top to be scrolled with them.
+    if (!_enc.has (Encoder::Cap::ScrollRegion) || !_enc.has (Encoder::Cap::InsertLine) || !_enc.has (Encoder::Cap::DeleteLine))
+	return Rect();
+    auto& warea = w->area();
+    if (warea.x || warea.w != _surface.size().w || warea.h < c_MinScrollRows)
+	return Rect();
+    if (auto wi = find (_windows, w); wi)
+	for (++wi; wi < _windows.end(); ++wi)
+	    if (!warea.clip ((*wi)->area()).empty())
+		return Rect();
+
+    // Find the range of changed rows
+    dim_t top = warea.h, bot = 0;
+    for (dim_t y = 0; y < warea.h; ++y) {
+	auto& dspan = w->damage().row (y);
+	if (dspan.size() && dspan.size() != _surface.first_changed (Point (dspan.first, warea.y+y), w->surface(), Point (dspan.first, y), dspan.size())) {
+	    top = min (top, y);
+	    bot = y+1;
 	}
     }
+    if (bot < top + c_MinScrollRows)
+	return Rect();
+    auto bestd = scroll_shift (_surface, warea.y, w->surface(), top, bot);
+    if (!bestd)
+	return Rect();
+
+    end_output (_enc.scroll (begin_output (1), warea.y+top, warea.y+bot, bestd));
+    _surface.scroll (warea.y+top, warea.y+bot, bestd);
+    return Rect (0, top, warea.w, bot-top);
+}
+
+int TerminalScreen::scroll_shift (const Surface& scr, dim_t sy, const Surface& ws, dim_t top, dim_t bot)
+{
+    // Hash old and new rows, then pick the shift that leaves the most rows correct
+    unsigned n = bot-top;
+    vector<uint64_t> oh (n), nh (n);
+    for (auto y = 0u; y < n; ++y) {
+	oh[y] = hash_row (scr, sy+top+y);
+	nh[y] = hash_row (ws, top+y);
+    }
+    auto blankcell = Surface::default_cell();
+    uint64_t blank = 0xcbf29ce484222325;
+    for (auto x = 0u; x < ws.size().w; ++x)
+	blank = hash_cell (blank, *pointer_cast<uint64_t>(&blankcell));
+    auto nmatched = [&](int d) {
+	auto nm = 0u;
+	for (auto y = 0u; y < n; ++y)
+	    nm += nh[y] == (y+d < n ? oh[y+d] : blank);
+	return nm;
+    };
+    int bestd = 0;
+    auto bestm = nmatched (0) + c_MinScrollRows - 1;
+    for (int d = 1-int(n); d < int(n); ++d) {
+	if (!d)
+	    continue;
+	if (auto m = nmatched (d); m > bestm) {
+	    bestd = d;
+	    bestm = m;
+	}
+    }
+    return bestd;
+}
+
+// On a slow link, a window is drawn in parts. The caret row, where the
+// user is typing, goes first. Rows past the frame's byte budget, and
+// cells with only attribute changes while text is still changing, are
+// left damaged and drawn in later frames, with full attributes once
+// the text is done.
+bool TerminalScreen::has_text_changes (const TerminalScreenWindow* w) const
+{
+    auto& warea = w->area();
+    for (dim_t y = 0; y < warea.h; ++y) {
+	auto dspan = w->damage().row (y);
+	for (auto x = dspan.first; x < dspan.last; ++x)
+	    if (!(_surface.cell (warea.x+x, warea.y+y).c == w->surface().cell (x, y).c))
+		return true;
+    }
+    return false;
+}
+
+void TerminalScreen::draw_window (TerminalScreenWindow* w, size_t outlimit)
+{
+    assert (flag (f_UIMode));
+    assert (Rect(screen_info().size()).clip (w->area()) == w->area() && "you must use position_window to set window area");
+    if (w->area().empty())
+	return;
+    auto& warea = w->area();
+    auto wid = w->window_id();
+    auto slow = outlimit != SIZE_MAX;
+    auto textonly = slow && has_text_changes (w);
+    Damage left;
+    if (slow)
+	left.resize (warea.size());
+    auto deferred = false;
+    dim_t cy = 0;
+    if (slow && dim_t(w->caret().y) < warea.h)
+	cy = w->caret().y;
+    // Scrolled rows are no longer where damage tracking expects them
+    auto scrolled = scroll_window (w);
+    for (dim_t i = 0; i < warea.h; ++i) {
+	dim_t y = !i ? cy : i - (i <= cy);
+	// Only the damaged span of each row is scanned
+	auto dspan = w->damage().row (y);
+	if (scrolled.contains (0, y))
+	    dspan = Damage::Span { 0, warea.w };
+	if (dspan.empty())
+	    continue;
+	if (_tout.size() > outlimit) {
+	    left.add (y, dspan.first, dspan.last);
+	    deferred = true;
+	    continue;
+	}
+	auto& ws = w->surface();
+	_fstats.scanned += dspan.size();
+	assert (warea.x+dspan.last <= _surface.size().w && warea.y+y < _surface.size().h && "position_window must clip each window to screen area");
+	auto owner = _owner.iat ((warea.y+y)*_surface.size().w + warea.x);
+	auto o = begin_output (dspan.size());
+	// and of it, only runs of changed cells, not covered by other windows, are written
+	auto next_changed = [&](dim_t x) { return x + _surface.first_changed (Point (warea.x+x, warea.y+y), ws, Point (x, y), dspan.last-x); };
+	for (auto x = next_changed (dspan.first); x < dspan.last;) {
+	    auto xe = x + _surface.first_unchanged (Point (warea.x+x, warea.y+y), ws, Point (x, y), dspan.last-x);
+	    for (; x < xe; ++x) {
+		if (owner[x] != wid)
+		    continue;
+		auto p = Point (warea.x+x, warea.y+y);
+		auto ic = ws.cell (x, y);
+		if (textonly && _surface.cell (p.x, p.y).c == ic.c) {
+		    left.add (y, x, x+1);
+		    deferred = true;
+		    continue;
+		}
+		// Identical cells, like lines and bars, are written as a run
+		dim_t rn = 1;
+		if (!textonly && !ic.c.is_wide_tail())
+		    while (x+rn < xe && owner[x+rn] == wid && ws.cell (x+rn, y) == ic)
+			++rn;
+		o = _enc.move_to (o, p, _surface);
+		o = rn > 1 ? _enc.write_run (o, ic, rn) : _enc.write_cell (o, ic);
+		// The right half of a wide char is written with it
+		if (rn == 1 && x+1 < xe && owner[x+1] == wid && _enc.wrote_wide (p) && ws.cell (x+1, y).c.is_wide_tail())
+		    ++rn;
+		_surface.copy_cells (p.x, p.y, ws, x, y, rn);
+		_fstats.changed += rn;
+		x += rn-1;
+	    }
+	    x = next_changed (x);
+	}
+	end_output (o);
+    }
+    w->clear_damage();
+    if (deferred) {
+	w->damage_area (left);
+	queue_draw (w);
+    }
     // Turn on the caret, if set in window
-    auto caretpos = w->caret() + w->area().pos();
-    bool careton = w->area().contains (caretpos);
+    auto caretpos = w->caret() + warea.pos();
+    bool careton = warea.contains (caretpos) && _owner[caretpos.y*_surface.size().w + caretpos.x] == wid;
     caret_state (careton);
-    if (careton && _curwpos != caretpos) {
-	_curwpos = caretpos;
-	_tout.appendf (T_MOVE_TO, caretpos.y+1, caretpos.x+1);
+    if (careton && _enc.pos() != caretpos)
+	end_output (_enc.move_to (begin_output (1), caretpos, _surface));
+}
+
+void TerminalScreen::draw_uncovered (void)
+{
+    for (dim_t y = 0; y < _surface.size().h; ++y) {
+	auto dspan = _uncovered.row (y);
+	if (dspan.empty())
+	    continue;
+	_fstats.scanned += dspan.size();
+	auto o = begin_output (dspan.size());
+	auto blank = [&](dim_t x) { return _owner[y*_surface.size().w + x] == c_NoOwner && _surface.cell (x, y) != Surface::default_cell(); };
+	for (auto x = dspan.first; x < dspan.last; ++x) {
+	    if (!blank (x))
+		continue;
+	    dim_t rn = 1;
+	    while (x+rn < dspan.last && blank (x+rn))
+		++rn;
+	    o = _enc.move_to (o, Point (x, y), _surface);
+	    o = _enc.write_run (o, Surface::default_cell(), rn);
+	    for (auto i = 0u; i < rn; ++i)
+		_surface.set_cell (x+i, y, Surface::default_cell());
+	    _fstats.changed += rn;
+	    x += rn-1;
+	}
+	end_output (o);
+    }
+    _uncovered.clear();
+    set_flag (f_Uncovered, false);
+}
+
+void TerminalScreen::compose_frame (void)
+{
+    if (_queued.empty() && !flag (f_ClearPending) && !flag (f_Uncovered))
+	return;
+    // Cells drawn after the escaped cell table filled up could not be
+    // stored in the compact format, so the screen and its windows
+    // switch to the full format, and everything is drawn again.
+    if (_surface.is_compact() && Surface::escapes_full()) {
+	_surface.set_format (Surface::Format::Full);
+	for (auto& w : _windows)
+	    w->on_new_screen_info();
+	reset();
+    }
+    auto start = nstime();
+    auto oldsz = _tout.size();
+    auto oldmoves = _enc.moves(), oldsgrs = _enc.sgrs();
+    // All queued windows are drawn together, and when the terminal
+    // supports synchronized updates, shown together.
+    if (flag (f_SyncUpdate))
+	_tout += T_SYNC_UPDATE_BEGIN;
+    if (flag (f_ClearPending)) {
+	set_flag (f_ClearPending, false);
+	_tout +=
+	    T_SET_DEFAULT_ATTRS
+	    T_CLEAR_SCREEN;
+    }
+    if (flag (f_Uncovered))
+	draw_uncovered();
+    // On a slow link, output is limited to what can be written in
+    // c_SlowFrameTime at the measured rate.
+    auto outlimit = SIZE_MAX;
+    if (_drainrate && !flag (f_Headless))
+	outlimit = _tout.size() + max (_drainrate * c_SlowFrameTime / 1000000000, size_t(c_MinFrameBudget));
+    // Each cell is only written by its owner, so the order does not
+    // matter, and the focused window on top is drawn first. Windows
+    // with changes left for later frames are queued again.
+    auto queued = move (_queued);
+    _queued.clear();
+    for (auto w = _windows.end(); w-- > _windows.begin();)
+	if (find (queued, *w) && !(*w)->flag (TerminalScreenWindow::f_Unused))
+	    draw_window (*w, outlimit);
+    if (flag (f_SyncUpdate))
+	_tout += T_SYNC_UPDATE_END;
+
+    // Frame stats are kept for the last Stats::RecentFrames
+    _fstats.moves = _enc.moves() - oldmoves;
+    _fstats.sgrs = _enc.sgrs() - oldsgrs;
+    _fstats.bytes = _tout.size() - oldsz;
+    _fstats.encode_us = (nstime() - start) / 1000;
+    _frames [_nframes++ % Stats::RecentFrames] = _fstats;
+    _fstats = {};
+}
+
+auto TerminalScreen::stats (void) const -> Stats
+{
+    Stats s = {};
+    s.frames = _nframes;
+    s.recent = min (_nframes, uint32_t(Stats::RecentFrames));
+    if (_nframes)
+	s.last = _frames [(_nframes-1) % Stats::RecentFrames];
+    for (auto i = 0u; i < s.recent; ++i) {
+	auto& f = _frames[i];
+	s.sum.add (f);
+	s.changed.add (f.changed);
+	s.bytes.add (f.bytes);
+	s.encode_us.add (f.encode_us);
     }
+    return s;
+}
 
-    // Write the buffer
-    _ptermo.wait_write (STDOUT_FILENO);
+// Composes the next frame when it is due on the frame clock, and
+// the last one has drained below the output limit. Draws arriving
+// in between only update window surfaces, so when output falls
+// behind, intermediate frames are dropped in favor of the newest.
+bool TerminalScreen::pace_frame (void)
+{
+    if (_queued.empty() && !flag (f_ClearPending) && !flag (f_Uncovered))
+	return false;
+    if (_tout.size() > _outlimit)
+	return false;	// write_output waits for the terminal
+    // Headless frames are not paced, so tests do not depend on timing
+    auto now = nstime();
+    if (now < _nextframe && !flag (f_Headless) && _frametimer >= 0) {
+	itimerspec ts = {};
+	ts.it_value.tv_sec = _nextframe / 1000000000;
+	ts.it_value.tv_nsec = _nextframe % 1000000000;
+	if (!timerfd_settime (_frametimer, TFD_TIMER_ABSTIME, &ts, nullptr)) {
+	    _pframe.wait_read (_frametimer);
+	    return false;
+	}
+    }
+    // Output rate is measured when the terminal could not keep up,
+    // and otherwise is assumed to be enough for any frame rate.
+    if (flag (f_OutputStalled) && now > _framestart) {
+	auto rate = (_framebytes - _tout.size()) * UINT64_C(1000000000) / (now - _framestart);
+	_drainrate = _drainrate ? (_drainrate*3 + rate)/4 : rate;
+    } else
+	_drainrate = 0;
+    set_flag (f_OutputStalled, false);
+
+    auto oldsz = _tout.size();
+    compose_frame();
+    _framebytes = _tout.size();
+    _framestart = now;
+
+    // The next frame waits for this one to be written at that rate
+    uint64_t interval = 1000000000 / _maxfps;
+    if (_drainrate)
+	interval = max (interval, (_framebytes-oldsz) * UINT64_C(1000000000) / _drainrate);
+    interval = min (interval, c_MaxFrameInterval);
+    _nextframe = now + interval;
+    _fps = min (1000000000 / interval, uint64_t(UINT8_MAX));
+    return true;
 }
 
 //}}}-------------------------------------------------------------------
 //{{{ TerminalScreen input processing
 
-void TerminalScreen::Timer_timer (fd_t)
+// Writes queued output until done or the terminal blocks
+bool TerminalScreen::write_output (void)
 {
-    static constexpr const Event c_vsync_event (Event::Type::VSync, 0, 60);
-    static constexpr const Event c_close_event (Event::Type::Close);
-
-    if (!flag (f_UIMode))
-	return;
-
+    if (flag (f_Headless))
+	_tout.write (_vt, _rec);
     while (!_tout.empty()) {
-	auto bw = write (STDOUT_FILENO, _tout.data(), _tout.size());
-	if (bw == 0)
-	    return error ("terminal closed");
-	else if (bw < 0) {
+	auto bw = _tout.write (_ofd, _rec);
+	if (bw == 0) {
+	    error ("terminal closed");
+	    return false;
+	} else if (bw < 0) {
 	    if (errno == EINTR)
 		continue;
 	    if (errno == EAGAIN) {
-		_ptermo.wait_write (STDOUT_FILENO);
+		++_fstats.stalls;
+		set_flag (f_OutputStalled);
+		_ptermo.wait_write (_ofd);
 		break;
 	    }
-	    return error_libc ("write");
+	    error_libc ("write");
+	    return false;
+	}
+    }
+    return true;
+}
+
+void TerminalScreen::Timer_timer (fd_t fd)
+{
+    static constexpr const Event c_close_event (Event::Type::Close);
+
+    if (!flag (f_UIMode))
+	return;
+
+    // Clear the frame timer, so that it stops polling readable
+    if (fd >= 0 && fd == _frametimer) {
+	uint64_t nexp;
+	if (0 > read (fd, &nexp, sizeof(nexp)) && errno != EAGAIN)
+	    return error_libc ("read");
+    }
+    // Earlier output is written first, since it holds back the next frame
+    if (!write_output() || (pace_frame() && !write_output()))
+	return;
+
+    // Windows may draw again when their last draw has been composed into
+    // a frame, and the output is not backed up. The vsync event has how
+    // many times it was held back, and the current frame rate.
+    for (auto& w : _windows) {
+	if (!w->flag (TerminalScreenWindow::f_DrawInProgress) && !w->flag (TerminalScreenWindow::f_DrawPending))
+	    continue;
+	if (_tout.size() > _outlimit)
+	    ++_outstalls;
+	else if (!find (_queued, w)) {
+	    w->on_event (Event (Event::Type::VSync, _outstalls, _fps));
+	    _outstalls = 0;
 	}
-	_tout.erase (_tout.begin(), bw);
     }
-    if (_tout.empty())
-	for (auto& w : _windows)
-	    if (w->flag (TerminalScreenWindow::f_DrawInProgress) || w->flag (TerminalScreenWindow::f_DrawPending))
-		_windows.back()->on_event (c_vsync_event);
 
     while (_tin.capacity() > _tin.size()) {
-	auto br = read (STDIN_FILENO, _tin.end(), _tin.capacity()-_tin.size());
+	auto br = read (_ifd, _tin.end(), _tin.capacity()-_tin.size());
 	if (br == 0) {
 	    if (!flag (f_InputEOF)) {
 		set_flag (f_InputEOF);
@@ -414,87 +1899,231 @@ void TerminalScreen::Timer_timer (fd_t)
     parse_keycodes();
 }
 
-struct EscSeq { char s[5]; unsigned char k; };
-
-static const EscSeq* match_escape_sequence (const char* s, size_t n)
-{
-    //{{{2 c_seq - key escape sequence mapping
-    static constexpr const EscSeq c_seq[] = {
-	{ "O2P",	Key::Print	},
-	{ "O2Q",	Key::Break	},
-	{ "OA",		Key::Up		},
-	{ "OB",		Key::Down	},
-	{ "OC",		Key::Right	},
-	{ "OD",		Key::Left	},
-	{ "OE",		Key::Center	},
-	{ "OF",		Key::End	},
-	{ "OH",		Key::Home	},
-	{ "OP",		Key::F1		},
-	{ "OQ",		Key::F2		},
-	{ "OR",		Key::F3		},
-	{ "OS",		Key::F4		},
-	{ "Ou",		Key::Center	},
-	{ "[11~",	Key::F1		},
-	{ "[12~",	Key::F2		},
-	{ "[13~",	Key::F3		},
-	{ "[14~",	Key::F4		},
-	{ "[15~",	Key::F5		},
-	{ "[17~",	Key::F6		},
-	{ "[18~",	Key::F7		},
-	{ "[19~",	Key::F8		},
-	{ "[1~",	Key::Home	},
-	{ "[20~",	Key::F9		},
-	{ "[21~",	Key::F10	},
-	{ "[23~",	Key::F11	},
-	{ "[24~",	Key::F12	},
-	{ "[2~",	Key::Insert	},
-	{ "[3~",	Key::Delete	},
-	{ "[4~",	Key::End	},
-	{ "[5~",	Key::PageUp	},
-	{ "[6~",	Key::PageDown	},
-	{ "[7~",	Key::Home	},
-	{ "[8~",	Key::End	},
-	{ "[<",		Key::Wheel	},
-	{ "[A",		Key::Up		},
-	{ "[B",		Key::Down	},
-	{ "[C",		Key::Right	},
-	{ "[D",		Key::Left	},
-	{ "[E",		Key::Center	},
-	{ "[F",		Key::End	},
-	{ "[G",		Key::Center	},
-	{ "[H",		Key::Home	},
-	{ "[M",		Key::Wheel	},
-	{ "[P",		Key::Break	},
-	{ "[[A",	Key::F1		},
-	{ "[[B",	Key::F2		},
-	{ "[[C",	Key::F3		},
-	{ "[[D",	Key::F4		},
-	{ "[[E",	Key::F5		}
-    };
-    //}}}2
-    const EscSeq* match = nullptr;
-    for (auto& sm : c_seq) {
-	match = &sm;
-	for (auto i = 0u; i < size(sm.s) && sm.s[i]; ++i) {
-	    if (i >= n || sm.s[i] != s[i]) {
-		match = nullptr;
-		break;
-	    }
-	}
-	if (match)
+//{{{2 Escape sequence decoding
+
+// A CSI or SS3 sequence, parsed in one pass
+struct EscSeq {
+    uint8_t	n;	// Length, 0 if incomplete or not a sequence
+    char	intro;	// '[' for CSI, 'O' for SS3
+    char	prefix;	// Private parameter prefix, one of "<=>?", or '[' on the linux console
+    char	imm;	// Intermediate byte
+    char	final;
+    uint8_t	nparam;
+    uint16_t	param [4];
+};
+
+// Sequences longer than this are discarded as garbage
+static constexpr const uint8_t c_MaxEscLen = 32;
+
+static EscSeq parse_escape (const char* s, size_t n)
+{
+    EscSeq e = {};
+    if (!n || (s[0] != '[' && s[0] != 'O'))
+	return e;
+    e.intro = s[0];
+    auto i = 1u;
+    for (; i < n && i < c_MaxEscLen; ++i) {
+	auto c = s[i];
+	if (c >= '0' && c <= '9') {
+	    if (!e.nparam)
+		e.nparam = 1;
+	    if (e.nparam <= size(e.param))
+		e.param[e.nparam-1] = e.param[e.nparam-1]*10 + c-'0';
+	} else if (c == ';' || c == ':')
+	    e.nparam = max (e.nparam, uint8_t(1)) + 1;
+	else if (i == 1 && ((c >= '<' && c <= '?') || (c == '[' && e.intro == '[')))
+	    e.prefix = c;
+	else if (c >= ' ' && c <= '/')
+	    e.imm = c;
+	else if (c >= '@' && c <= '~') {
+	    e.final = c;
 	    break;
+	} else {		// a control char aborts the sequence
+	    e.n = i;
+	    return e;
+	}
+    }
+    if (!e.final) {
+	if (i >= c_MaxEscLen)
+	    e.n = i;
+	return e;
+    }
+    e.n = i+1;
+    // X10 mouse reports are followed by three raw bytes
+    if (e.intro == '[' && e.final == 'M' && !e.prefix && !e.nparam)
+	e.n = e.n+3u <= n ? e.n+3 : 0;
+    return e;
+}
+
+// Key codes for each final byte and each ~ sequence parameter
+struct KeyTables {
+    Event::key_t	csi [64];
+    Event::key_t	ss3 [64];
+    Event::key_t	tilde [25];	// up to F12, "[24~"
+    Event::key_t	mods [16];
+public:
+    constexpr KeyTables (void) : csi{},ss3{},tilde{},mods{} {
+	constexpr const char c_arrows[] = "ABCDEFGH";
+	constexpr const Event::key_t c_arrow_keys[] =
+	    { Key::Up, Key::Down, Key::Right, Key::Left, Key::Center, Key::End, Key::Center, Key::Home };
+	for (auto i = 0u; i < size(c_arrow_keys); ++i)
+	    csi[c_arrows[i]-'@'] = ss3[c_arrows[i]-'@'] = c_arrow_keys[i];
+	ss3['G'-'@'] = 0;
+	for (auto i = 0u; i < 4; ++i)
+	    csi['P'-'@'+i] = ss3['P'-'@'+i] = Key::F1+i;
+	csi['Z'-'@'] = KMod::Shift+Key::Tab;
+	ss3['M'-'@'] = Key::Enter;
+	ss3['u'-'@'] = Key::Center;
+
+	constexpr const Event::key_t c_tilde_keys[] = {
+	    0, Key::Home, Key::Insert, Key::Delete, Key::End,
+	    Key::PageUp, Key::PageDown, Key::Home, Key::End, 0,
+	    0, Key::F1, Key::F2, Key::F3, Key::F4,
+	    Key::F5, 0, Key::F6, Key::F7, Key::F8,
+	    Key::F9, Key::F10, 0, Key::F11, Key::F12
+	};
+	for (auto i = 0u; i < size(c_tilde_keys); ++i)
+	    tilde[i] = c_tilde_keys[i];
+
+	// The modifier parameter is 1 plus a mask of shift, alt, ctrl, and meta
+	for (auto m = 0u; m < size(mods); ++m)
+	    mods[m] = (m & 1 ? KMod::Shift : 0) | (m & 2 ? KMod::Alt : 0)
+		    | (m & 4 ? KMod::Ctrl : 0) | (m & 8 ? KMod::Banner : 0);
+    }
+};
+static constexpr const KeyTables c_keys;
+
+static Event::key_t escape_key (const EscSeq& e)
+{
+    Event::key_t k = 0;
+    unsigned mod = 0;
+    if (e.imm)
+	return 0;
+    if (e.prefix == '[') {	// linux console F1-F5
+	if (e.final >= 'A' && e.final <= 'E')
+	    k = Key::F1 + (e.final-'A');
+    } else if (e.prefix)
+	return 0;		// terminal replies and mouse reports are not keys
+    else if (e.final == '~') {	// "[n;m~"
+	if (e.param[0] < size(c_keys.tilde))
+	    k = c_keys.tilde[e.param[0]];
+	mod = e.param[1];
+    } else {			// "[1;mX" or "OmX"
+	k = (e.intro == 'O' ? c_keys.ss3 : c_keys.csi)[e.final-'@'];
+	mod = e.param[e.intro == 'O' && e.nparam < 2 ? 0 : 1];
+	if (e.intro == '[' && e.final == 'P' && !e.nparam)
+	    k = Key::Break;	// the Pause key on the linux console
     }
-    return match;
+    if (k && mod > 1)
+	k |= c_keys.mods[(mod-1) % size(c_keys.mods)];
+    return k;
+}
+
+// The parts of a sequence that tell keys apart, packed into one number.
+// Sequences with more than two parameters are not keys, and not packed.
+static constexpr uint64_t escape_code (const EscSeq& e)
+{
+    return uint8_t(e.final) | uint8_t(e.prefix) << 8 | uint8_t(e.imm) << 16
+	| (e.intro == 'O') << 24 | uint64_t(e.nparam) << 25
+	| uint64_t(e.param[0]) << 32 | uint64_t(e.param[1]) << 48;
 }
 
+void TerminalScreen::load_terminfo_keys (void)
+{
+    // Key strings starting with Esc are parsed here once, so that input
+    // is matched against them only after parse_escape, by escape code.
+    _tikeys.clear();
+    _tirawkeys.clear();
+    for (auto i = 0u; i < size(c_terminfo_keys); ++i) {
+	auto ks = _tinfo.str (Terminfo::Str (uint8_t(Terminfo::Str::KeyFirst)+i));
+	if (ks[0] != '\033' || !ks[1])
+	    continue;
+	auto klen = strlen (ks+1);
+	if (auto e = parse_escape (ks+1, klen); e.n == klen && e.final && e.nparam <= 2)
+	    _tikeys.push_back (TerminfoKey { escape_code (e), c_terminfo_keys[i] });
+	else
+	    _tirawkeys.push_back (i);
+    }
+}
+
+Event::key_t TerminalScreen::terminfo_key (const char* s, size_t n, size_t& klen) const
+{
+    // Matches key strings that are not escape sequences,
+    // s being the input after the Esc.
+    for (auto i : _tirawkeys) {
+	auto ks = _tinfo.str (Terminfo::Str (uint8_t(Terminfo::Str::KeyFirst)+i));
+	klen = strlen (ks+1);
+	if (klen <= n && !memcmp (s, ks+1, klen))
+	    return c_terminfo_keys[i];
+    }
+    return 0;
+}
+
+//}}}2
+
+void TerminalScreen::mouse_event (unsigned b, const Point& p, bool released)
+{
+    // Sent to the topmost window under the pointer, in its coordinates
+    if (!Rect (_surface.size()).contains (p))
+	return;
+    auto wid = _owner [p.y*_surface.size().w + p.x];
+    auto wi = find_if (_windows, [&](auto w){ return w->window_id() == wid; });
+    if (!wi)
+	return;
+    auto w = *wi;
+    auto wp = Point (p.x - w->area().x, p.y - w->area().y);
+
+    // Low two bits are the button, then shift, alt, ctrl, motion, and wheel
+    Event::key_t kmods = (b & 4 ? KMod::Shift : 0) | (b & 8 ? KMod::Alt : 0) | (b & 16 ? KMod::Ctrl : 0);
+    if (b & 64) {	// the wheel scrolls like arrow keys
+	static constexpr const Event::key_t c_wheel_keys[] = { Key::Up, Key::Down, Key::Left, Key::Right };
+	return w->on_event (Event (Event::Type::KeyDown, kmods | c_wheel_keys[b & 3]));
+    }
+    static constexpr const Event::key_t c_button_mods[] = { KMod::Left, KMod::Middle, KMod::Right, 0 };
+    kmods |= c_button_mods[b & 3];
+    auto type = b & 32 ? Event::Type::Motion : (released ? Event::Type::ButtonUp : Event::Type::ButtonDown);
+    w->on_event (Event (type, wp, uint8_t(kmods >> KMod::FirstBit)));
+}
+
+// Pasted text larger than this is delivered in pieces
+static constexpr const size_t c_MaxPasteBuffer = 16*1024*1024;
+
 void TerminalScreen::parse_keycodes (void)
 {
     if (_windows.empty() || !_windows.back()->is_mapped())
 	return;
+    // Runs of the same key, as from autorepeat, are sent as one event
+    // with the repeat count in mods, so that the UI can catch up.
+    Event::key_t rkey = 0;
+    uint8_t nrep = 0;
+    auto send_key = [&]{
+	if (nrep)
+	    _windows.back()->on_event (Event (Event::Type::KeyDown, rkey, nrep));
+	nrep = 0;
+    };
     istream is (_tin.data(), _tin.size());
     while (is.remaining()) {
 	auto ic = is.ptr<char>();
 
+	if (flag (f_Pasting)) {
+	    send_key();
+	    // Bracketed paste is delivered whole, up to the end marker
+	    auto pe = static_cast<const char*>(memmem (ic, is.remaining(), T_PASTE_END, strlen(T_PASTE_END)));
+	    if (!pe) {
+		if (_tin.size() < _tin.capacity() || _tin.capacity() < c_MaxPasteBuffer || is.remaining() < strlen(T_PASTE_END))
+		    break;	// wait for the rest, _tin grows below
+		// The end marker may be split, so keep enough for it
+		pe = is.end() - (strlen(T_PASTE_END)-1);
+		_windows.back()->on_paste (ic, pe-ic);
+		is.skip (pe-ic);
+		break;
+	    }
+	    _windows.back()->on_paste (ic, pe-ic);
+	    is.skip (pe-ic + strlen(T_PASTE_END));
+	    set_flag (f_Pasting, false);
+	    continue;
+	}
+
 	auto cb = utf8::ibytes (*ic);
 	if (is.remaining() < cb)
 	    break;	// incomplete multibyte char
@@ -511,10 +2140,31 @@ void TerminalScreen::parse_keycodes (void)
 	else if (c < 27)	// 1-26 is ctrl+a - ctrl+z with exceptions of backspace, tab, and newline above
 	    c = KMod::Ctrl+('a'-1+c);
 	else if (c == 27) {	// Esc key or a compound key sequence
-	    auto ematch = match_escape_sequence (ic, is.end()-ic);
-	    if (ematch) {	// compound sequence
-		c = ematch->k;
-		is.skip (4-(ematch->s[3]?0:(ematch->s[2]?1:2))); // sequences are 2-4 bytes
+	    if (size_t klen; !_tirawkeys.empty() && (c = terminfo_key (ic, is.end()-ic, klen)))
+		is.skip (klen);
+	    else if (auto e = parse_escape (ic, is.end()-ic); e.n) {
+		is.skip (e.n);
+		if (e.prefix == '?' && e.imm == '$' && e.final == 'y') {
+		    // DECRPM reply; values 1 and 2 are set and reset, 0 and 4 unknown and unsupported
+		    if (e.param[0] == 2026)
+			set_flag (f_SyncUpdate, e.param[1] == 1 || e.param[1] == 2);
+		    continue;
+		}
+		if (e.final == '~' && e.param[0] == 200 && !e.prefix) {
+		    set_flag (f_Pasting);	// bracketed paste start marker
+		    continue;
+		}
+		if (e.prefix == '<' && (e.final == 'M' || e.final == 'm')) {
+		    // SGR mouse report "[<b;x;yM", m for button release
+		    send_key();
+		    mouse_event (e.param[0], Point (e.param[1]-1, e.param[2]-1), e.final == 'm');
+		    continue;
+		}
+		// Modified keys are not in terminfo and are left to escape_key
+		if (auto tk = find_if (_tikeys, [ec = escape_code (e)](auto& k){ return k.code == ec; }); tk)
+		    c = tk->key;
+		else if (!(c = escape_key (e)))
+		    continue;	// unknown sequence
 	    } else if (_tin.capacity() <= _tin.size())
 		break;		// possible incomplete sequence, try again later
 	    else if (ic < is.end() && *ic >= ' ' && *ic <= '~') {
@@ -527,33 +2177,49 @@ void TerminalScreen::parse_keycodes (void)
 	    c = Key::Print;
 	else if (c == 127)
 	    c = Key::Backspace;
-	_windows.back()->on_event (Event (Event::Type::KeyDown, c));
+	if (c != rkey || nrep >= UINT8_MAX)
+	    send_key();
+	rkey = c;
+	++nrep;
     }
+    send_key();
     _tin.erase (_tin.begin(), is.begin()-_tin.begin());
+    // A paste in progress must fit in the buffer
+    if (flag (f_Pasting) && _tin.capacity() <= _tin.size())
+	_tin.reserve (min (size_t(_tin.capacity())*2, c_MaxPasteBuffer));
     if (_tin.capacity() > _tin.size() && !flag (f_InputEOF))
-	_ptermi.wait_read (STDIN_FILENO);
+	_ptermi.wait_read (_ifd);
 }
 
 //}}}-------------------------------------------------------------------
 //{{{ TerminalScreenWindow
 
 IMPLEMENT_INTERFACES_D (TerminalScreenWindow)
+IMPLEMENT_INTERFACES_D (TerminalScreenStats)
 
 TerminalScreenWindow::TerminalScreenWindow (Msg::Link l)
 : Msger (l)
+,_scr (&TerminalScreen::client_screen (l.src))
 ,_surface()
+,_cellgen()
+,_drawn()
+,_stale()
+,_damage()
 ,_viewport()
 ,_pos()
 ,_caret (-1,-1)
 ,_attr (Surface::default_cell())
 ,_winfo()
+,_palette()
+,_gen()
 {
-    TerminalScreen::instance().register_window (this);
+    reset_palette();
+    screen().register_window (this);
 }
 
 TerminalScreenWindow::~TerminalScreenWindow (void)
 {
-    TerminalScreen::instance().unregister_window (this);
+    screen().unregister_window (this);
 }
 
 void TerminalScreenWindow::on_event (const Event& ev)
@@ -574,6 +2240,21 @@ void TerminalScreenWindow::on_event (const Event& ev)
 void TerminalScreenWindow::Screen_open (const WindowInfo& wi)
 {
     _winfo = wi;
+    if (!flag (f_Opened)) {
+	// A window is shown on the screen of its parent, which may not be
+	// the one its creator was found on, as for a dialog from a window
+	// on a pty. The creator's other windows then follow it there.
+	if (auto ps = TerminalScreen::window_screen (wi.parent()); ps && ps != _scr) {
+	    screen().unregister_window (this);
+	    _scr = ps;
+	    screen().add_client (creator_link().src);
+	    screen().register_window (this);
+	    Screen_get_info();
+	}
+	screen().open_window (this);
+	set_flag (f_Opened);
+    }
+    screen().recorder().write (TerminalScreen::Recorder::Type::Open, msger_id(), &wi, sizeof(wi));
     on_resize (clip_to_screen());
 }
 
@@ -583,20 +2264,62 @@ void TerminalScreenWindow::reset (void)
     _attr = Surface::default_cell();
     _pos = Point();
     _caret = Point(-1,-1);
-    _surface.clear();
+    // Cells drawn in the last frame must be rescanned, and are cleared
+    // lazily: those drawn again are cleared by mark_drawn, and the rest
+    // by clear_stale when the frame is done. Cells outside of _drawn
+    // are always blank, so a wrapped _gen matching an old stamp is ok.
+    _damage.add (_drawn);
+    _stale.add (_drawn);
+    _drawn.clear();
+    ++_gen;
+}
+
+void TerminalScreenWindow::mark_drawn (const Rect& r)
+{
+    for (auto y = r.y; y < r.y+r.h; ++y) {
+	auto g = _cellgen.iat (y*_surface.size().w);
+	for (auto x = r.x; x < r.x+r.w; ++x) {
+	    if (g[x] != _gen) {
+		g[x] = _gen;
+		_surface.set_cell (x, y, Surface::default_cell());
+	    }
+	}
+    }
+    _drawn.add (r);
+    _damage.add (r);
+}
+
+void TerminalScreenWindow::clear_stale (void)
+{
+    for (dim_t y = 0; y < _surface.size().h; ++y) {
+	auto sspan = _stale.row (y);
+	auto g = _cellgen.iat (y*_surface.size().w);
+	for (auto x = sspan.first; x < sspan.last; ++x)
+	    if (g[x] != _gen)
+		_surface.set_cell (x, y, Surface::default_cell());
+    }
+    _stale.clear();
 }
 
 void TerminalScreenWindow::on_resize (const Rect& warea)
 {
     _winfo.set_area (warea);
+    _surface.set_format (screen().surface().format());
     _surface.resize (_winfo.area().size());
+    _surface.clear();
+    _cellgen.resize (_winfo.area().w * _winfo.area().h);
+    _drawn.resize (_winfo.area().size());
+    _stale.resize (_winfo.area().size());
+    _damage.resize (_winfo.area().size());
     IScreen::Reply (creator_link()).resize (_winfo);
     reset();
+    damage_all();
+    screen().restack (this);
 }
 
 void TerminalScreenWindow::on_new_screen_info (void)
 {
-    if (auto newarea = clip_to_screen(); newarea != area())
+    if (auto newarea = clip_to_screen(); newarea != area() || _surface.format() != screen().surface().format())
 	on_resize (newarea);
     IScreen::Reply (creator_link()).screen_info (screen_info());
 }
@@ -607,7 +2330,8 @@ void TerminalScreenWindow::on_new_screen_info (void)
 void TerminalScreenWindow::Draw_reset (void)
 {
     reset();
-    TerminalScreen::instance().reset();
+    reset_palette();
+    screen().reset();
 }
 
 void TerminalScreenWindow::Draw_enable (uint8_t f)
@@ -643,15 +2367,53 @@ icolor_t TerminalScreenWindow::clip_color (icolor_t c, Surface::Attr::EAttr fatt
 }
 
 void TerminalScreenWindow::Draw_draw_color (icolor_t c)
-    { _attr.fg = clip_color (c, Surface::Attr::Bold); }
+    { _attr.set_fgc (_palette [clip_color (c, Surface::Attr::Bold)]); }
 void TerminalScreenWindow::Draw_fill_color (icolor_t c)
-    { _attr.bg = clip_color (c, Surface::Attr::Blink); }
+    { _attr.set_bgc (_palette [clip_color (c, Surface::Attr::Blink)]); }
+
+void TerminalScreenWindow::Draw_set_color (icolor_t c, color_t rgb)
+{
+    // Redefined colors are approximated on 256 color terminals,
+    // and ignored on those with fewer colors.
+    if (screen_info().depth() >= 8)
+	_palette[c] = screen().color_code (rgb);
+}
+
+void TerminalScreenWindow::Draw_palette (icolor_t f, const vector_view<color_t>& pal)
+{
+    for (auto i = 0u; i < pal.size() && f+i < size(_palette); ++i)
+	Draw_set_color (f+i, pal[i]);
+}
+
+void TerminalScreenWindow::Draw_palette3 (icolor_t f, const vector_view<colray_t>& pal)
+{
+    for (auto i = 0u; i+2 < pal.size() && f+i/3 < size(_palette); i += 3)
+	Draw_set_color (f+i/3, RGB (pal[i], pal[i+1], pal[i+2]));
+}
 
 void TerminalScreenWindow::Draw_char (char32_t c, HAlign, VAlign)
 {
-    if (_viewport.contains (_pos))
-	*_surface.iat(_pos) = cell_from_char (c);
-    ++_pos.x;
+    auto w = char_width (c);
+    if (!w) {	// combining mark, added to the char before it
+	if (_viewport.contains (_pos.x-1, _pos.y)) {
+	    mark_drawn (Rect (_pos.x-1, _pos.y, 1, 1));
+	    auto pc = _surface.cell (_pos.x-1, _pos.y);
+	    pc.c.append (c);
+	    _surface.set_cell (_pos.x-1, _pos.y, pc);
+	}
+	return;
+    }
+    // Wide chars are drawn only when both halves are visible
+    if (_viewport.contains (_pos) && (w < 2 || _viewport.contains (_pos.x+1, _pos.y))) {
+	mark_drawn (Rect (_pos, Size (w,1)));
+	auto cc = cell_from_char (c);
+	_surface.set_cell (_pos.x, _pos.y, cc);
+	if (w > 1) {
+	    cc.c.set_wide_tail();
+	    _surface.set_cell (_pos.x+1, _pos.y, cc);
+	}
+    }
+    _pos.x += w;
 }
 
 void TerminalScreenWindow::Draw_char_bar (const Size& wh, char32_t c)
@@ -659,19 +2421,20 @@ void TerminalScreenWindow::Draw_char_bar (const Size& wh, char32_t c)
     auto orect = _viewport.clip (Rect (_pos, wh));
     if (orect.empty())
 	return;
-    auto o = _surface.iat (orect.pos());
-    auto rowskip = _surface.size().w - orect.w;
+    mark_drawn (orect);
     auto oc = cell_from_char (c);
-    for (auto r = orect.h; r--; o += rowskip) {
-	for (auto x = orect.w; x--; ++o) {
-	    o->c = oc.c;
+    for (auto y = orect.y; y < orect.y+orect.h; ++y) {
+	for (auto x = orect.x; x < orect.x+orect.w; ++x) {
+	    auto o = _surface.cell (x, y);
+	    o.c = oc.c;
 	    if (oc.c.c[0] == ' ') {
-		o->bg = oc.bg;
-		o->attr = oc.attr;
+		o.set_bgc (oc.bgc());
+		o.attr = oc.attr;
 	    } else {
-		o->fg = oc.fg;
-		o->attr |= oc.attr;
+		o.set_fgc (oc.fgc());
+		o.attr |= oc.attr;
 	    }
+	    _surface.set_cell (x, y, o);
 	}
     }
 }
@@ -703,42 +2466,63 @@ void TerminalScreenWindow::Draw_edit_text (const string& t, uint32_t cp, HAlign
 	auto lend = find (l, tend, char32_t('\n'));
 	if (!lend)
 	    lend = tend;
-	lsz = lend-l;
+	// Line size is in columns, with wide and zero-width chars
+	lsz = 0;
+	for (auto i = l; i < lend; ++i)
+	    lsz += char_width (*i);
 
 	// Clip lines above and below the viewport
 	if (dim_t(ly-_viewport.y) < _viewport.h) {
-	    auto lx = tx;
+	    int lx = tx;
 	    if (ha == HAlign::Center)
-		lx -= lsz/2;
+		lx -= int(lsz/2);
 	    else if (ha == HAlign::Right)
-		lx -= lsz;
+		lx -= int(lsz);
 
-	    // Clip to left edge of viewport
-	    auto vlx = lx - _viewport.x;
-	    if (vlx < 0) {
-		l -= vlx;
-		lx -= vlx;
-	    }
-
-	    // l is now the first visible char, line invisible if l is past lend
-	    if (l < lend) {
-		// Clip against the right side of the viewport
-		auto nvis = min (lend-l, (_viewport.x + _viewport.w) - lx);
-		auto vislend = l + nvis;
+	    // Clip by columns to the left and right sides of the viewport
+	    int vl = _viewport.x, vr = _viewport.x + _viewport.w;
+	    if (auto dl = max (lx, vl), dr = min (lx+int(lsz), vr); dl < dr)
+		mark_drawn (Rect (dl, ly, dr-dl, 1));
 
+	    int prev = -1;	// last drawn column, for combining marks
+	    for (auto x = lx; l <= lend; ++l) {
 		// Set the caret position if it is on this line and visible
-		if (vislend >= cpi && l <= cpi) {
-		    _caret.x = lx + (cpi-l);
+		if (l == cpi && x >= vl && x <= vr) {
+		    _caret.x = x;
 		    _caret.y = ly;
 		}
-
-		// Draw the actual characters
-		for (auto o = _surface.iat (lx, ly); l < vislend; ++o, ++l) {
+		if (l == lend)
+		    break;
+		int w = char_width (*l);
+		if (!w) {
+		    if (prev >= 0) {
+			auto pc = _surface.cell (prev, ly);
+			pc.c.append (*l);
+			_surface.set_cell (prev, ly, pc);
+		    }
+		    continue;
+		}
+		prev = -1;
+		if (x+w > vl && x < vr) {
 		    auto cc = cell_from_char (*l);
-		    o->c = cc.c;
-		    o->fg = cc.fg;
-		    o->attr |= cc.attr;
+		    auto put = [&](int px, Cell::Char c) {
+			auto o = _surface.cell (px, ly);
+			o.c = c;
+			o.set_fgc (cc.fgc());
+			o.attr |= cc.attr;
+			_surface.set_cell (px, ly, o);
+			return px;
+		    };
+		    if (x < vl || x+w > vr) {	// the visible half of a clipped wide char
+			cc.c = ' ';
+			put (max (x, vl), cc.c);
+		    } else {
+			prev = put (x, cc.c);
+			if (w > 1)
+			    put (x+1, Cell::Char{});	// the wide tail
+		    }
 		}
+		x += w;
 	    }
 	}
 	l = lend+1;	// go to next line
@@ -862,8 +2646,11 @@ void TerminalScreenWindow::Draw_panel (const Size& wh, PanelType t)
 
 void TerminalScreenWindow::Screen_draw (const cmemlink& dl)
 {
+    screen().note_draw (this);
+    screen().recorder().write (TerminalScreen::Recorder::Type::Draw, msger_id(), dl.data(), dl.size());
     reset();
-    Drawlist::dispatch (this, dl);
+    DrawlistGraphic::dispatch (this, dl);
+    clear_stale();
     draw();
 }
 
@@ -874,7 +2661,7 @@ void TerminalScreenWindow::draw (void)
     else {
 	set_flag (f_DrawPending, false);
 	set_flag (f_DrawInProgress);
-	TerminalScreen::instance().draw_window (this);
+	screen().queue_draw (this);
     }
 }
 
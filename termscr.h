@@ -5,7 +5,10 @@
 
 #pragma once
 #include "draw.h"
+#include "terminfo.h"
 #include <cwiclo/app.h>
+#include <termios.h>
+#include <sys/uio.h>
 
 namespace cwiclui {
 
@@ -16,7 +19,7 @@ class TerminalScreenWindow;
 class TerminalScreen : public Msger {
     IMPLEMENT_INTERFACES_I (Msger,,(ITimer)(ISignal))
 public:
-    enum { f_UIMode = Msger::f_Last, f_CaretOn, f_InputEOF, f_Last };
+    enum { f_UIMode = Msger::f_Last, f_CaretOn, f_InputEOF, f_XtermModes, f_SyncUpdate, f_ClearPending, f_Uncovered, f_Pasting, f_Headless, f_OutputStalled, f_Last };
     using windowid_t = WindowInfo::windowid_t;
     //{{{ Surface
     class Surface {
@@ -44,31 +47,76 @@ public:
 		    } else
 			operator= (char(v));
 		}
-		constexpr void	operator= (const Char& v)	{ u = v.u; }
 		constexpr bool	operator== (const Char& v)const	{ return u == v.u; }
-		constexpr bool	is_ascii (void) const		{ return c[0] >= ' ' && c[0] <= '~'; }
+		constexpr bool	is_ascii (void) const		{ return c[0] >= ' ' && c[0] <= '~' && !c[1]; }
+		// The cell right of a wide char is empty, and not written
+		constexpr bool	is_wide_tail (void) const	{ return !u; }
+		constexpr void	set_wide_tail (void)		{ u = 0; }
+		// Bytes in the char and any combining marks after it
+		constexpr unsigned size (void) const {
+		    auto n = utf8::ibytes (c[0]);
+		    while (n < sizeof(c) && c[n])
+			++n;
+		    return n;
+		}
+		// Appends a combining mark, if there is room for it
+		constexpr void	append (char32_t v) {
+		    Cell r = {}; *utf8::out(&r.c.c[0]) = v;
+		    auto n = size(), vn = r.c.size();
+		    if (n + vn > sizeof(c))
+			return;
+		    for (auto i = 0u; i < vn; ++i)
+			c[n+i] = r.c.c[i];
+		    for (auto i = n+vn; i < sizeof(c); ++i)
+			c[i] = 0;
+		}
 	    };
 	public:
 	    Char	c;
-	    uint8_t	z;
+	    uint8_t	xc;	// High bits of fg and bg color codes, see RgbTable
 	    uint8_t	attr;
 	    icolor_t	fg,bg;
 	public:
 	    constexpr bool	operator== (const Cell& v) const { return *pointer_cast<uint64_t>(this) == *pointer_cast<uint64_t>(&v); }
 	    constexpr bool	operator!= (const Cell& v) const { return !operator==(v); }
+	    constexpr uint16_t	fgc (void) const		{ return fg | (xc & 0xf) << 8; }
+	    constexpr uint16_t	bgc (void) const		{ return bg | (xc >> 4) << 8; }
+	    constexpr void	set_fgc (uint16_t v)		{ fg = v; xc = (xc & 0xf0) | (v >> 8); }
+	    constexpr void	set_bgc (uint16_t v)		{ bg = v; xc = (xc & 0x0f) | (v >> 8) << 4; }
+	    constexpr bool	same_colors (const Cell& v) const { return attr == v.attr && fg == v.fg && bg == v.bg && xc == v.xc; }
 	};
 	using value_type	= Cell;
 	using cellvec_t		= vector<Cell>;
 	using iterator		= cellvec_t::iterator;
 	using const_iterator	= cellvec_t::const_iterator;
+	// Without RGB colors, most cells are a single byte char with
+	// 256 color codes, and fit in 4 bytes: char, attr, fg, and bg.
+	// Other cells are kept in a table shared by all surfaces, and
+	// stored as the c_Escaped byte followed by their 24 bit index.
+	// Equal cells thus have equal codes in all compact surfaces.
+	// When the table is full, surfaces must use the full format.
+	enum class Format : uint8_t { Full, Compact };
+	using code_t = uint32_t;
+	static constexpr const uint8_t c_Escaped = 0xff;	// not valid in UTF-8
     public:
-			Surface (void)		:_sz(),_cells() {}
+			Surface (void)		:_sz(),_cells(),_codes(),_fmt() {}
+	// Cell pointers and iterators are only available in the full format
 	auto		begin (void)		{ return _cells.begin(); }
 	auto		begin (void) const	{ return _cells.begin(); }
 	auto		end (void)		{ return _cells.end(); }
 	auto		end (void) const	{ return _cells.end(); }
 	auto&		size (void) const	{ return _sz; }
-	void		resize (const Size& sz)	{ _sz = sz; _cells.resize (_sz.w*_sz.h); }
+	auto		format (void) const	{ return _fmt; }
+	bool		is_compact (void) const	{ return _fmt == Format::Compact; }
+	void		set_format (Format f);
+	static bool	escapes_full (void) PURE;
+	void		resize (const Size& sz);
+	Cell		cell (dim_t x, dim_t y) const
+			    { auto i = index (x,y); return is_compact() ? decode (_codes[i]) : _cells[i]; }
+	void		set_cell (dim_t x, dim_t y, const Cell& c)
+			    { auto i = index (x,y); if (is_compact()) _codes[i] = encode (c); else _cells[i] = c; }
+	// Copies n cells from a surface of the same format
+	void		copy_cells (dim_t x, dim_t y, const Surface& s, dim_t sx, dim_t sy, dim_t n);
 	auto		iat (dim_t x, dim_t y)		{ return _cells.iat (y*_sz.w+x); }
 	auto		iat (dim_t x, dim_t y) const	{ return _cells.iat (y*_sz.w+x); }
 	auto		iat (const Point& p)		{ return iat(p.x,p.y); }
@@ -76,41 +124,409 @@ public:
 	auto		iat (const Offset& o)		{ return iat(o.dx,o.dy); }
 	auto		iat (const Offset& o) const	{ return iat(o.dx,o.dy); }
 	static constexpr auto default_cell (void) { return Cell {{" "}, 0, 0, IColor::Default, IColor::Default }; }
-	void		clear (void)		{ fill (_cells, default_cell()); }
+	void		clear (void);
+	void		scroll (dim_t top, dim_t bot, int n);
+	// Vectorized, picking the widest unit supported at runtime
+	static dim_t	first_changed (const Cell* a, const Cell* b, dim_t n) PURE;
+	static constexpr dim_t first_unchanged (const Cell* a, const Cell* b, dim_t n)
+			    { dim_t i = 0; while (i < n && a[i] != b[i]) ++i; return i; }
+	// Same, on n cells at a in this surface and b in s, of the same format
+	dim_t		first_changed (const Point& a, const Surface& s, const Point& b, dim_t n) const PURE;
+	dim_t		first_unchanged (const Point& a, const Surface& s, const Point& b, dim_t n) const PURE;
+	static code_t	encode (const Cell& c) {
+			    if (c.xc || c.c.c[1] || c.c.c[2] || c.c.c[3] || uint8_t(c.c.c[0]) == c_Escaped)
+				return escape (c);
+			    return uint8_t(c.c.c[0]) | c.attr << 8 | c.fg << 16 | code_t(c.bg) << 24;
+			}
+	static Cell	decode (code_t v) {
+			    if (uint8_t(v) == c_Escaped)
+				return unescape (v);
+			    Cell c = {}; c.c.c[0] = v; c.attr = v >> 8; c.fg = v >> 16; c.bg = v >> 24;
+			    return c;
+			}
+    private:
+	size_t		index (dim_t x, dim_t y) const	{ return y*_sz.w+x; }
+	static code_t	escape (const Cell& c);
+	static Cell	unescape (code_t v) PURE;
     private:
 	Size		_sz;
 	vector<Cell>	_cells;
+	vector<code_t>	_codes;
+	Format		_fmt;
+    };
+    //}}}
+    //{{{ Damage
+    // Bounding span of modified cells in each row of a surface
+    class Damage {
+    public:
+	struct Span {
+	    dim_t	first;
+	    dim_t	last;
+	public:
+	    constexpr bool	empty (void) const	{ return first >= last; }
+	    constexpr dim_t	size (void) const	{ return empty() ? 0 : last-first; }
+	};
+    public:
+			Damage (void)		:_w(),_rows() {}
+	void		resize (const Size& sz)	{ _w = sz.w; _rows.resize (sz.h); clear(); }
+	auto&		row (dim_t y) const	{ return _rows[y]; }
+	void		clear (void)		{ fill (_rows, Span { _w, 0 }); }
+	void		add_all (void)		{ fill (_rows, Span { 0, _w }); }
+	void		add (dim_t y, dim_t f, dim_t l)
+			    { auto& r = _rows[y]; r.first = min (r.first, f); r.last = max (r.last, l); }
+	void		add (const Rect& r)
+			    { for (dim_t y = r.y; y < r.y+r.h; ++y) add (y, r.x, r.x+r.w); }
+	void		add (const Damage& d)
+			    { for (auto y = 0u; y < _rows.size(); ++y) add (y, d._rows[y].first, d._rows[y].last); }
+    private:
+	dim_t		_w;
+	vector<Span>	_rows;
+    };
+    //}}}
+    //{{{ RgbTable
+    // Truecolor values interned into 12-bit cell color codes. Codes
+    // below First are palette indexes, the rest index the table. Cells
+    // store the high bits in Cell::xc, and still compare as one word.
+    class RgbTable {
+    public:
+	using code_t = uint16_t;
+	enum : code_t { First = 256, Last = 4096 };
+    public:
+			RgbTable (void)		:_rgb(),_slots() {}
+	auto		size (void) const	{ return _rgb.size(); }
+	color_t		operator[] (code_t c) const { return _rgb[c-First]; }
+	code_t		intern (color_t c);
+    private:
+	enum { SlotBits = 13, NSlots = 1u << SlotBits };
+	static_assert (NSlots > Last-First, "RgbTable hash must have free slots when full");
+    private:
+	vector<color_t>	_rgb;
+	vector<code_t>	_slots;	// Open addressed hash of codes, 0 if unused
+    };
+    //}}}
+    //{{{ Encoder
+    // Converts changed cells into terminal output. Output is written
+    // directly into a buffer reserved by the caller, MaxCellBytes per
+    // cell, using precomputed sequences instead of printf formatting.
+    class Encoder {
+    public:
+	using Cell = Surface::Cell;
+	enum { MaxCellBytes = 80 };
+	// Optional sequences, used when the terminal supports them
+	struct Cap {
+	    enum ECap {
+		ScrollRegion,
+		InsertLine,
+		DeleteLine,
+		CursorUp,
+		CursorDown,
+		CursorRight,
+		CursorLeft,
+		ColumnAddress,
+		RowAddress,
+		EraseChars,
+		RepeatChar,
+		ClearToEol,
+		AutoWrap,	// Writing past the last column wraps to the next row
+		BackColorErase,	// Erased cells take the current background color
+		Last
+	    };
+	};
+	// Without terminfo, assume a vt100 with line insertion
+	static constexpr const uint16_t DefaultCaps = ((1u << Cap::ColumnAddress)-1) | (1u << Cap::AutoWrap);
+    public:
+			Encoder (void)			:_lastcell (Surface::default_cell()),_pos(),_scrsz(),_caps (DefaultCaps),_rgb(),_nmoves(),_nsgrs() {}
+	auto&		pos (void) const		{ return _pos; }
+	// A wide char written at p also covers the cell right of it
+	bool		wrote_wide (const Point& p) const { return _pos.y == p.y && _pos.x == p.x+2; }
+	bool		has (Cap::ECap c) const		{ return get_bit (_caps, c); }
+	void		set_caps (uint16_t c)		{ _caps = c; }
+	auto&		colors (void) const		{ return _rgb; }
+	auto&		colors (void)			{ return _rgb; }
+	void		set_screen_size (const Size& sz){ _scrsz = sz; }
+	void		reset (void)			{ _lastcell = Surface::default_cell(); _pos = Point(); }
+	char*		move_to (char* o, const Point& p, const Surface& scr);
+	char*		move_to (char* o, const Point& p);
+	char*		write_cell (char* o, Cell c);
+	char*		write_run (char* o, const Cell& c, dim_t n);
+	char*		scroll (char* o, dim_t top, dim_t bot, int n);
+	static char*	write_uint (char* o, unsigned n);
+	auto		moves (void) const		{ return _nmoves; }
+	auto		sgrs (void) const		{ return _nsgrs; }
+    private:
+	// A cursor motion along one axis, with its cost in bytes
+	struct Motion {
+	    unsigned	cost;
+	    char	how;	// Final char of the CSI sequence, a control char, or r to reprint
+	public:
+	    constexpr void	consider (bool ok, unsigned c, char h) { if (ok && c < cost) { cost = c; how = h; } }
+	};
+	enum { NoMotion = UINT16_MAX };
+    private:
+	char*		write_attrs (char* o, const Cell& c);
+	char*		write_color (char* o, uint16_t c, unsigned base) const;
+	static char*	write_csi (char* o, unsigned n, char f);
+	bool		reprintable (const Surface& scr, dim_t x, dim_t y, dim_t n) const PURE;
+	Motion		hmotion (dim_t x, const Point& p, const Surface& scr) const;
+	Motion		vmotion (dim_t y, const Point& p, bool linefeed) const;
+	char*		write_motion (char* o, const Motion& m, dim_t from, dim_t to, const Surface& scr, dim_t y) const;
+    private:
+	Cell		_lastcell;
+	Point		_pos;
+	Size		_scrsz;
+	uint16_t	_caps;
+	RgbTable	_rgb;
+	uint32_t	_nmoves;	// Cursor motions written
+	uint32_t	_nsgrs;		// and attribute sequences
+    };
+    //}}}
+    //{{{ Emulator
+    // A small VT parser for the sequences the Encoder writes, keeping
+    // what the terminal would show in a reference cell grid. Output
+    // goes here in headless mode, and benchmarks use it to check and
+    // count the encoded output without a tty.
+    class Emulator {
+    public:
+	using Cell = Surface::Cell;
+    public:
+			Emulator (void);
+	auto&		surface (void) const	{ return _scr; }
+	auto&		pos (void) const	{ return _pos; }
+	auto&		colors (void) const	{ return _rgb; }
+	auto		bytes (void) const	{ return _nbytes; }
+	auto		sequences (void) const	{ return _nseqs; }
+	void		resize (const Size& sz);
+	void		write (const char* s, size_t n);
+	string		text (void) const;
+    private:
+	enum class State : uint8_t { Ground, Esc, Charset, Csi };
+	enum { MaxParams = 16 };
+    private:
+	unsigned	param (unsigned i, unsigned def = 1) const
+			    { return i < _nparams && _params[i] ? _params[i] : def; }
+	void		print (char32_t c);
+	void		control (char c);
+	void		csi (char f);
+	void		sgr (void);
+	void		linefeed (void);
+	void		erase (dim_t x, dim_t y, size_t n);
+    private:
+	Surface		_scr;
+	Cell		_pen;	// Attributes and colors set by SGR
+	Point		_pos;	// x is the screen width while a wrap is pending
+	dim_t		_top;	// Scroll region is rows [top,bot)
+	dim_t		_bot;
+	RgbTable	_rgb;
+	size_t		_nbytes;
+	size_t		_nseqs;
+	char32_t	_last;	// Last printed char, for REP
+	char32_t	_uc;	// UTF-8 char being decoded
+	uint8_t		_ucn;	// and how many bytes of it are still to come
+	State		_state;
+	bool		_shifted;	// SO selected the DEC graphics set
+	char		_mark;	// Private marker or intermediate in the CSI
+	uint8_t		_nparams;
+	uint16_t	_params [MaxParams];
+    };
+    //}}}
+    //{{{ Recorder
+    // Writes what a screen does to a file, for replay: the screen size,
+    // the windows opened, the drawlists they send, and the bytes written
+    // to the terminal. The file starts with c_Magic, followed by records,
+    // each a Header and its data. Recording stops on a write error.
+    class Recorder {
+    public:
+	enum class Type : uint8_t { Screen, Open, Draw, Output };
+	struct Header {
+	    uint64_t	time;	// ns since recording started
+	    uint32_t	size;	// of the data following
+	    Type	type;
+	    uint8_t	reserved;
+	    uint16_t	id;	// Window id for Open and Draw
+	};
+	static constexpr const char c_Magic[8] = "CWUIREC";
+    public:
+			Recorder (void)		:_fd (-1),_start() {}
+			~Recorder (void)	{ close(); }
+	bool		open (const char* filename);
+	void		close (void);
+	bool		is_open (void) const	{ return _fd >= 0; }
+	void		write (Type t, uint16_t id, const iovec* iov, unsigned niov, size_t n);
+	void		write (Type t, uint16_t id, const void* p, size_t n)
+			    { iovec iov = { const_cast<void*>(p), n }; write (t, id, &iov, 1, n); }
+    private:
+	void		write_all (const void* p, size_t n);
+    private:
+	fd_t		_fd;
+	uint64_t	_start;
+    };
+    //}}}
+    //{{{ Output
+    // Queue of terminal output, stored in chunks. Appending never moves
+    // queued data, and written chunks are dropped from the front without
+    // copying the rest. Flushed with writev.
+    class Output {
+    public:
+	enum { ChunkSize = 16*1024 };
+    public:
+			Output (void)		:_chunks(),_spare(),_head(),_size() {}
+	auto		size (void) const	{ return _size; }
+	bool		empty (void) const	{ return !_size; }
+	char*		reserve (size_t n);
+	void		commit (const char* e)
+			    { auto& c = _chunks.back(); _size += e - c.end(); c.shrink (e - c.begin()); }
+	void		append (const char* s, size_t n)
+			    { auto o = reserve (n); memcpy (o, s, n); commit (o+n); }
+	auto&		operator+= (const char* s)	{ append (s, strlen(s)); return *this; }
+	ssize_t		write (fd_t fd, Recorder& rec);
+	void		write (Emulator& vt, Recorder& rec);
+	void		clear (void)		{ _chunks.clear(); _head = _size = 0; }
+    private:
+	void		consume (size_t n);
+    private:
+	vector<memblock> _chunks;
+	memblock	_spare;	// Written chunk kept for reuse
+	size_t		_head;	// Bytes of the first chunk already written
+	size_t		_size;	// Bytes queued and not yet written
+    };
+    //}}}
+    //{{{ Stats
+    // Rendering costs of a frame. Stalls and dropped draws are
+    // counted in the frame composed after them.
+    struct FrameStats {
+	uint32_t	scanned;	// Damaged cells compared with the screen
+	uint32_t	changed;	// Cells written
+	uint32_t	moves;		// Cursor motions
+	uint32_t	sgrs;		// Attribute sequences
+	uint32_t	bytes;		// Output queued
+	uint32_t	encode_us;	// Time to compose the frame
+	uint32_t	stalls;		// Writes that would block
+	uint32_t	dropped;	// Window drawlists replaced before being shown
+    public:
+	constexpr void	add (const FrameStats& f) {
+			    scanned += f.scanned; changed += f.changed; moves += f.moves; sgrs += f.sgrs;
+			    bytes += f.bytes; encode_us += f.encode_us; stalls += f.stalls; dropped += f.dropped;
+			}
+    };
+    // Frames by the bit width of a value, the last bucket has the rest
+    struct Histogram {
+	enum { Buckets = 16 };
+	uint16_t	n [Buckets];
+    public:
+	constexpr void	add (uint32_t v)
+			    { ++n [min (v ? 32u-__builtin_clz(v) : 0u, unsigned(Buckets-1))]; }
+    };
+    // What a monitor gets from IRenderStats, over the recent frames
+    struct Stats {
+	enum { RecentFrames = 64 };
+	uint32_t	frames;		// Composed since the screen was created
+	uint32_t	recent;		// Frames summed and counted below
+	FrameStats	last;
+	FrameStats	sum;
+	Histogram	changed;
+	Histogram	bytes;
+	Histogram	encode_us;
     };
     //}}}
 public:
-    static auto& instance (void) { static TerminalScreen s_scr; return s_scr; }
+    // The screen on the controlling terminal
+    static auto& instance (void) { static TerminalScreen s_scr (STDIN_FILENO, STDOUT_FILENO, getenv("TERM")); return s_scr; }
+    // Screens on other terminals, like ptys or serial consoles, can be
+    // created in the same process. A window is shown on the screen of
+    // its parent window, or on the one its creator was added to with
+    // add_client, or else on instance(), and the screen must outlive it.
+    // A client stays on its screen until its last window there closes.
+		TerminalScreen (fd_t ifd, fd_t ofd, const char* term);
+		~TerminalScreen (void) override;
+    void	add_client (mrid_t id)		{ if (!find (_clients, id)) _clients.push_back (id); }
+    static TerminalScreen& client_screen (mrid_t id);
+    static TerminalScreen* window_screen (windowid_t id);
+    // The shift of rows [top,bot) of a full-width window surface, shown
+    // at row sy of the screen surface, that makes the most rows match,
+    // if enough to be worth scrolling for, or 0.
+    static int	scroll_shift (const Surface& scr, dim_t sy, const Surface& ws, dim_t top, dim_t bot);
     void	reset (void);
     void	register_window (TerminalScreenWindow* w);
     void	unregister_window (const TerminalScreenWindow* w);
+    void	open_window (const TerminalScreenWindow* w);
     Rect	position_window (const WindowInfo& winfo) const;
-    void	draw_window (const TerminalScreenWindow* w);
+    void	queue_draw (TerminalScreenWindow* w);
+    void	restack (const TerminalScreenWindow* resized = nullptr);
     inline void	Signal_signal (const ISignal::Info& s);
     void	Timer_timer (fd_t fd);
     auto&	screen_info (void) const { return _scrinfo; }
-protected:
-		TerminalScreen (void);
-		~TerminalScreen (void) override;
+    void	set_output_limit (size_t n)	{ _outlimit = n; }
+    void	set_max_fps (unsigned fps)	{ _maxfps = max (fps, 1u); }
+    // Output goes to an Emulator instead of the tty, and the screen it
+    // shows is printed on exit. Must be set before opening windows.
+    void	set_headless (void)		{ set_flag (f_Headless); }
+    RgbTable::code_t color_code (color_t c);
+    auto&	surface (void) const	{ return _surface; }
+    Stats	stats (void) const;
+    // Records drawlists and output to the file, see Recorder
+    bool	record (const char* filename);
+    auto&	recorder (void)			{ return _rec; }
+    // A drawlist for a window still waiting to be composed replaces the last one
+    void	note_draw (const TerminalScreenWindow* w)	{ if (find (_queued, w)) ++_fstats.dropped; }
 private:
+    bool	is_stdio (void) const		{ return _ifd == STDIN_FILENO; }
     inline void	ui_mode (void);
     void	tt_mode (void);
     void	update_screen_size (void);
     inline void	parse_keycodes (void);
+    void	load_terminfo_keys (void);
+    Event::key_t terminfo_key (const char* s, size_t n, size_t& klen) const;
     void	caret_state (bool on);
+    void	mouse_event (unsigned b, const Point& p, bool released);
+    Rect	scroll_window (const TerminalScreenWindow* w);
+    bool	has_text_changes (const TerminalScreenWindow* w) const PURE;
+    void	draw_window (TerminalScreenWindow* w, size_t outlimit);
+    void	draw_uncovered (void);
+    void	compose_frame (void);
+    bool	pace_frame (void);
+    bool	write_output (void);
+    char*	begin_output (size_t ncells)	{ return _tout.reserve (ncells*Encoder::MaxCellBytes); }
+    void	end_output (char* o)		{ _tout.commit (o); }
 private:
     vector<TerminalScreenWindow*> _windows;
-    string	_tout;
+    vector<mrid_t> _clients;	// Creators of windows to be shown here
+    vector<TerminalScreenWindow*> _queued;	// Windows to draw in the next frame
+    Output	_tout;
     memblaz	_tin;
     Surface	_surface;
+    vector<mrid_t> _owner;	// Id of the topmost window at each screen cell
+    Damage	_uncovered;	// Cells no longer covered by any window
     ScreenInfo	_scrinfo;
-    Surface::Cell _lastcell;
-    Point	_curwpos;
+    Terminfo	_tinfo;
+    // Terminfo key strings, parsed into the escape code they arrive as,
+    // or kept as indexes of c_terminfo_keys when they do not parse
+    struct TerminfoKey {
+	uint64_t	code;
+	Event::key_t	key;
+    };
+    vector<TerminfoKey> _tikeys;
+    vector<uint8_t> _tirawkeys;
+    Encoder	_enc;
+    Emulator	_vt;		// Terminal model in headless mode
+    size_t	_outlimit;	// Output allowed to be queued when starting a new frame
+    unsigned	_outstalls;	// Times output was backed up since the last vsync
+    uint64_t	_nextframe;	// Monotonic time in ns when the next frame may be composed
+    uint64_t	_framestart;	// and when the last one was
+    size_t	_framebytes;	// Output queued after composing the last frame
+    size_t	_drainrate;	// Bytes per second written while output was backed up
+    unsigned	_maxfps;
+    uint8_t	_fps;		// Frame rate allowed by the current frame interval
+    fd_t	_frametimer;	// timerfd for the next frame
+    uint32_t	_nframes;	// Frames composed, the last RecentFrames are in _frames
+    FrameStats	_fstats;	// Counts for the next frame
+    FrameStats	_frames [Stats::RecentFrames];
+    Recorder	_rec;
+    fd_t	_ifd;		// Terminal input
+    fd_t	_ofd;		// and output
+    struct termios _oldtios;	// Settings before ui_mode
     ITimer	_ptermi;
     ITimer	_ptermo;
+    ITimer	_pframe;
 };
 
 //----------------------------------------------------------------------
@@ -120,20 +536,30 @@ class TerminalScreenWindow : public Msger {
 public:
     using Surface	= TerminalScreen::Surface;
     using Cell		= Surface::Cell;
+    using Damage	= TerminalScreen::Damage;
+    using RgbTable	= TerminalScreen::RgbTable;
     using PanelType	= Drawlist::PanelType;
     using windowid_t	= WindowInfo::windowid_t;
-    enum { f_DrawInProgress = Msger::f_Last, f_DrawPending, f_Last };
+    enum { f_DrawInProgress = Msger::f_Last, f_DrawPending, f_Opened, f_Last };
 public:
 		TerminalScreenWindow (Msg::Link l);
 		~TerminalScreenWindow (void) override;
-    auto&	screen_info (void) const	{ return TerminalScreen::instance().screen_info(); }
+    auto&	screen (void) const		{ return *_scr; }
+    auto&	screen_info (void) const	{ return screen().screen_info(); }
     auto&	window_info (void) const	{ return _winfo; }
     auto	window_id (void) const		{ return msger_id(); }
     auto&	area (void) const		{ return window_info().area(); }
     auto&	viewport (void) const		{ return _viewport; }
     auto&	surface (void) const		{ return _surface; }
     auto&	caret (void) const		{ return _caret; }
+    auto&	damage (void) const		{ return _damage; }
+    void	clear_damage (void)		{ _damage.clear(); }
+    void	damage_all (void)		{ _damage.add_all(); }
+    void	damage_area (const Rect& r)	{ _damage.add (r); }
+    void	damage_area (const Damage& d)	{ _damage.add (d); }
     void	on_event (const Event& ev);
+    void	on_paste (const char* t, size_t n)
+		    { IScreen::Reply (creator_link()).clipboard (Event (Event::Type::Clipboard, Event::key_t(ClipboardOp::Read)), string (t, n)); }
     void	draw (void);
     void	reset (void);
     void	on_resize (const Rect& warea);
@@ -146,10 +572,14 @@ private:
     void	Screen_get_info (void)		{ IScreen::Reply (creator_link()).screen_info (screen_info()); }
     void	Screen_close (void)		{ set_unused (true); }
 		friend class Drawlist;
+		friend class DrawlistGraphic;
     Rect	interior_area (void) const	{ return Rect (area().size()); }
-    Rect	clip_to_screen (void) const	{ return TerminalScreen::instance().position_window (window_info()); }
+    Rect	clip_to_screen (void) const	{ return screen().position_window (window_info()); }
     icolor_t	clip_color (icolor_t c, Surface::Attr::EAttr fattr);
+    void	mark_drawn (const Rect& r);
+    void	clear_stale (void);
     auto	cell_from_char (char32_t c) const { Cell cc (_attr); cc.c = c; return cc; }
+    void	reset_palette (void)		{ for (auto i = 0u; i < size(_palette); ++i) _palette[i] = i; }
     inline void	Draw_reset (void);
     void	Draw_clear (void);
     inline void	Draw_enable (uint8_t feature);
@@ -160,6 +590,9 @@ private:
     void	Draw_line (const Offset& o);
     inline void	Draw_draw_color (icolor_t c);
     inline void	Draw_fill_color (icolor_t c);
+    void	Draw_set_color (icolor_t c, color_t rgb);
+    void	Draw_palette (icolor_t f, const vector_view<color_t>& pal);
+    void	Draw_palette3 (icolor_t f, const vector_view<colray_t>& pal);
     inline void	Draw_char (char32_t c, HAlign ha = HAlign::Left, VAlign va = VAlign::Top);
     inline void	Draw_text (const string& t, HAlign ha = HAlign::Left, VAlign va = VAlign::Top);
     void	Draw_box (const Size& wh);
@@ -168,11 +601,72 @@ private:
     void	Draw_panel (const Size& wh, PanelType t);
     void	Draw_edit_text (const string& t, uint32_t cp, HAlign ha, VAlign va);
 private:
+    TerminalScreen* _scr;	// Screen the window is shown on
     Surface	_surface;
+    vector<uint8_t> _cellgen;	// Frame in which each cell was last drawn
+    Damage	_drawn;
+    Damage	_stale;		// Drawn in an earlier frame, to be cleared
+    Damage	_damage;
     Rect	_viewport;
     Point	_pos,_caret;
     Cell	_attr;
     WindowInfo	_winfo;
+    RgbTable::code_t _palette [256];	// Color codes for drawlist color indexes
+    uint8_t	_gen;		// Current frame, for _cellgen
 };
 
+//----------------------------------------------------------------------
+//{{{ IRenderStats
+
+#define SIGNATURE_ui_FrameStats	"(uuuuuuuu)"
+#define SIGNATURE_ui_Histogram	"(qqqqqqqqqqqqqqqq)"
+#define SIGNATURE_ui_RenderStats	"(uu" SIGNATURE_ui_FrameStats SIGNATURE_ui_FrameStats\
+				    SIGNATURE_ui_Histogram SIGNATURE_ui_Histogram SIGNATURE_ui_Histogram ")"
+
+// Rendering statistics of a TerminalScreen, for monitoring. The screen
+// is the one the caller was added to as a client, or the stdio one.
+// Served by TerminalScreenStats, when it is in the app's msger list.
+class IRenderStats : public Interface {
+    DECLARE_INTERFACE (Interface, RenderStats,
+	(get,		"")
+	(stats,		SIGNATURE_ui_RenderStats)
+    )
+public:
+    using Stats	= TerminalScreen::Stats;
+public:
+    explicit	IRenderStats (mrid_t caller)	: Interface (caller) {}
+    void	get (void) const		{ send (m_get()); }
+    template <typename O>
+    inline static constexpr bool dispatch (O* o, const Msg& msg) {
+	if (msg.method() != m_get())
+	    return false;
+	o->RenderStats_get();
+	return true;
+    }
+public:
+    class Reply : public Interface::Reply {
+    public:
+	explicit constexpr Reply (Msg::Link l)	: Interface::Reply (l) {}
+	void	stats (const Stats& s) const	{ send (m_stats(), s); }
+	template <typename O>
+	inline static constexpr bool dispatch (O* o, const Msg& msg) {
+	    if (msg.method() != m_stats())
+		return false;
+	    o->RenderStats_stats (msg.read().read<Stats>());
+	    return true;
+	}
+    };
+};
+
+// Answers IRenderStats requests
+class TerminalScreenStats : public Msger {
+    IMPLEMENT_INTERFACES_I (Msger, (IRenderStats),)
+public:
+    explicit	TerminalScreenStats (Msg::Link l)	: Msger (l) {}
+    void	RenderStats_get (void) const
+		    { IRenderStats::Reply (creator_link()).stats (TerminalScreen::client_screen (creator_link().src).stats()); }
+};
+
+//}}}-------------------------------------------------------------------
+
 } // namespace cwiclui
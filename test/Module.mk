@@ -3,29 +3,49 @@
 test/srcs	:= $(wildcard test/*.cc)
 test/tsrcs	:= $(wildcard test/?????.cc)
 test/tests	:= $(addprefix $O,$(test/tsrcs:.cc=))
+test/bsrcs	:= $(wildcard test/*bench.cc)
+test/benches	:= $(addprefix $O,$(test/bsrcs:.cc=))
 test/objs	:= $(addprefix $O,$(test/srcs:.cc=.o))
 test/deps	:= ${test/objs:.o=.d}
-test/outs	:= ${test/tests:=.out}
+test/outs	:= ${test/tests:=.out} ${test/benches:=.out}
 
 ################ Compilation ###########################################
 
-.PHONY:	test/all check test/check test/clean
+.PHONY:	test/all check test/check test/clean bench test/bench
 
 test/all:	${test/tests}
 
 # The correct output of a test is stored in testXX.std
 # When the test runs, its output is compared to .std
+# TERMINFO points to a directory without entries, so that the
+# output does not depend on the installed terminfo database.
+# Benchmarks also check what they measure, and are run for that,
+# with their output shown only when a check fails.
 #
 check:		test/check
-test/check:	${test/tests}
+test/check:	${test/tests} ${test/benches}
 	@for i in ${test/tests}; do \
 	    test="test/$$(basename $$i)";\
 	    echo "Running $$test";\
-	    PATH="$Otest" TERM="xterm" LINES="47" COLUMNS="160" $$i < $$test.cc > $$i.out 2>&1;\
+	    PATH="$Otest" TERM="xterm" TERMINFO="test" LINES="47" COLUMNS="160" $$i < $$test.cc > $$i.out 2>&1;\
 	    diff $$test.std $$i.out && rm -f $$i.out;\
 	done
+	@for i in ${test/benches}; do \
+	    echo "Running test/$$(basename $$i)";\
+	    $$i > $$i.out 2>&1 && rm -f $$i.out || cat $$i.out;\
+	done
+
+# Benchmarks print timings, so their output is not compared,
+# but they fail when the checks of what they measure do.
+#
+bench:		test/bench
+test/bench:	${test/benches}
+	@for i in ${test/benches}; do \
+	    echo "Running test/$$(basename $$i)";\
+	    $$i || exit 1;\
+	done
 
-${test/tests}: $Otest/%: $Otest/%.o ${liba}
+${test/tests} ${test/benches}: $Otest/%: $Otest/%.o ${liba}
 	@echo "Linking $@ ..."
 	@${CC} ${ldflags} -o $@ $^ ${libs}
 
@@ -34,7 +54,7 @@ ${test/tests}: $Otest/%: $Otest/%.o ${liba}
 clean:	test/clean
 test/clean:
 	@if [ -d ${builddir}/test ]; then\
-	    rm -f ${test/tests} ${test/objs} ${test/deps} ${test/outs} $Otest/.d;\
+	    rm -f ${test/tests} ${test/benches} ${test/objs} ${test/deps} ${test/outs} $Otest/.d;\
 	    rmdir ${builddir}/test;\
 	fi
 
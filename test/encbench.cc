@@ -0,0 +1,566 @@
+// This file is part of the cwiclui project
+//
+// Copyright (c) 2021 by Mike Sharov <msharov@users.sourceforge.net>
+// This file is free software, distributed under the ISC License.
+
+#include "../termscr.h"
+#include <time.h>
+using namespace cwiclui;
+
+//{{{ Test surface -----------------------------------------------------
+
+using Surface	= TerminalScreen::Surface;
+using Cell	= Surface::Cell;
+using Encoder	= TerminalScreen::Encoder;
+using Emulator	= TerminalScreen::Emulator;
+
+enum { c_BenchW = 300, c_BenchH = 90, c_BenchFrames = 200 };
+
+// Fills the surface with dashboard-like content: text in runs
+// of different colors and attributes, separated by line chars.
+static void fill_dashboard (Surface& s)
+{
+    static constexpr const char c_text[] = "cpu 42% mem 3.1G net 118k/s disk 7ms ";
+    auto ci = s.begin();
+    for (auto y = 0u; y < s.size().h; ++y) {
+	for (auto x = 0u; x < s.size().w; ++x, ++ci) {
+	    *ci = Surface::default_cell();
+	    if (x % 50 == 49)
+		ci->c = char32_t(Drawlist::GChar::VLine);
+	    else
+		ci->c = c_text [(x+y) % (size(c_text)-1)];
+	    auto run = (x/12 + y) % 8;
+	    ci->fg = run < 4 ? icolor_t(IColor::Default) : icolor_t(IColor::Gray0+run);
+	    ci->bg = run == 5 ? IColor::Blue : IColor::Default;
+	    ci->attr = (run == 3) << Surface::Attr::Bold | (run == 7) << Surface::Attr::Reverse;
+	}
+    }
+}
+
+// Fills the surface with a box frame around bars and a progress bar,
+// all long runs of identical cells.
+static void fill_frames (Surface& s)
+{
+    auto w = s.size().w, h = s.size().h;
+    for (dim_t y = 0; y < h; ++y) {
+	for (dim_t x = 0; x < w; ++x) {
+	    auto c = s.iat (x, y);
+	    *c = Surface::default_cell();
+	    if (!y || y == h-1)
+		c->c = char32_t(x && x < w-1 ? Drawlist::GChar::HLine : (x ? (y ? Drawlist::GChar::LRCorner : Drawlist::GChar::URCorner) : (y ? Drawlist::GChar::LLCorner : Drawlist::GChar::ULCorner)));
+	    else if (!x || x == w-1)
+		c->c = char32_t(Drawlist::GChar::VLine);
+	    else if (y % 8 == 4)	// progress bar
+		c->c = char32_t(x < w*y/h ? Drawlist::GChar::Block : Drawlist::GChar::Checkerboard);
+	    else if (y % 8 == 6)	// status bar
+		c->bg = IColor::Blue;
+	}
+    }
+}
+
+// Fills row y with a line of log text, different for each seq
+static void fill_log_row (Surface& s, dim_t y, unsigned seq)
+{
+    auto c = s.iat (0, y);
+    for (dim_t x = 0; x < s.size().w; ++x, ++c) {
+	*c = Surface::default_cell();
+	c->c = char('a' + (x*7 + seq) % 26);
+	c->fg = icolor_t(IColor::Gray0 + seq%8);
+    }
+}
+
+// Moves rows [top,bot) of s up by n, or down if n is negative,
+// and fills the exposed rows with new log lines.
+static void scroll_log (Surface& s, dim_t top, dim_t bot, int n, unsigned seq)
+{
+    auto w = s.size().w;
+    if (n > 0) {
+	for (auto y = top; y < bot-n; ++y)
+	    copy_n (s.iat (0, y+n), w, s.iat (0, y));
+	for (auto y = bot-n; y < bot; ++y)
+	    fill_log_row (s, y, seq++);
+    } else {
+	for (auto y = bot; --y >= top-n;)
+	    copy_n (s.iat (0, y+n), w, s.iat (0, y));
+	for (auto y = top; y < top-n; ++y)
+	    fill_log_row (s, y, seq++);
+    }
+}
+
+// Fills the surface with text mixing wide chars, chars with
+// combining marks, and ASCII, shifted by seq on each row.
+static void fill_wide (Surface& s, unsigned seq)
+{
+    for (dim_t y = 0; y < s.size().h; ++y) {
+	for (dim_t x = 0; x < s.size().w; ++x) {
+	    auto c = s.iat (x, y);
+	    *c = Surface::default_cell();
+	    auto k = x + y + seq;
+	    c->fg = icolor_t(IColor::Gray0 + y%8);
+	    if (k % 5 == 0 && x+1 < s.size().w) {
+		c->c = char32_t(0x4e00 + k%64);	// CJK ideographs
+		c[1] = c[0];
+		c[1].c.set_wide_tail();
+		++x;
+	    } else if (k % 5 == 2) {
+		c->c = char('a' + k%26);
+		c->c.append (0x301);		// combining acute accent
+	    } else
+		c->c = char('a' + k%26);
+	}
+    }
+}
+
+static uint64_t nsnow (void)
+{
+    struct timespec t;
+    clock_gettime (CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1000000000ull + t.tv_nsec;
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Reference printf-based encoder
+
+// The terminal state, kept between frames
+struct PrintfState {
+		PrintfState (void) : lastcell (Surface::default_cell()),curpos() {}
+    Cell	lastcell;
+    Point	curpos;
+};
+
+static void printf_repaint (string& out, Surface& scr, const Surface& win, PrintfState& st)
+{
+    static constexpr const char c_acs_sym[] = "+,-.0`afghijklmnopqrstuvwxyz{|}~";
+    static const uint8_t c_attr_tseq[][2] = {{22,1},{23,3},{24,4},{25,5},{27,7}};
+    auto& lastcell = st.lastcell;
+    auto& curpos = st.curpos;
+    auto oci = scr.begin();
+    auto ici = win.begin();
+    for (coord_t y = 0; y < win.size().h; ++y) {
+	for (coord_t x = 0; x < win.size().w; ++x, ++ici, ++oci) {
+	    if (*oci == *ici)
+		continue;
+	    auto curcell = *ici;
+	    if (unsigned acsi = uint8_t(curcell.c.c[0]) - uint8_t(Drawlist::GChar::First); acsi < size(c_acs_sym)) {
+		curcell.c = c_acs_sym [acsi];
+		set_bit (curcell.attr, Surface::Attr::Altcharset);
+	    }
+	    uint8_t sgr[11], nsgr = 0;
+	    auto chattr = lastcell.attr ^ curcell.attr;
+	    for (auto a = 0u; a < size(c_attr_tseq); ++a)
+		if (get_bit (chattr, a))
+		    sgr[nsgr++] = c_attr_tseq[a][get_bit(curcell.attr,a)];
+	    if (curcell.bg != lastcell.bg) {
+		if (curcell.bg < 8)
+		    sgr[nsgr] = 40+curcell.bg;
+		else if (curcell.bg < 16)
+		    sgr[nsgr] = 92+curcell.bg;
+		else if (curcell.bg == IColor::Default)
+		    sgr[nsgr] = 49;
+		else {
+		    sgr[nsgr++] = 48;
+		    sgr[nsgr++] = 5;
+		    sgr[nsgr] = curcell.bg;
+		}
+		++nsgr;
+	    }
+	    if (curcell.fg != lastcell.fg) {
+		if (curcell.fg < 8)
+		    sgr[nsgr] = 30+curcell.fg;
+		else if (curcell.fg < 16)
+		    sgr[nsgr] = 82+curcell.fg;
+		else if (curcell.fg == IColor::Default)
+		    sgr[nsgr] = 39;
+		else {
+		    sgr[nsgr++] = 38;
+		    sgr[nsgr++] = 5;
+		    sgr[nsgr] = curcell.fg;
+		}
+		++nsgr;
+	    }
+	    Point wpos (x, y);
+	    if (wpos != curpos) {
+		auto dpos = wpos - curpos;
+		if (!dpos.dy && dpos.dx > 0) {
+		    if (dpos.dx < 5) {
+			for (auto uci = scr.iat (curpos); dpos.dx; --dpos.dx, ++uci) {
+			    if (uci->attr != lastcell.attr || uci->fg != lastcell.fg || uci->bg != lastcell.bg || !uci->c.is_ascii())
+				break;
+			    out += uci->c.c[0];
+			}
+		    }
+		    if (dpos.dx > 0)
+			out.appendf ("\033[%uC", dpos.dx);
+		} else
+		    out.appendf ("\033[%u;%uH", wpos.y+1, wpos.x+1);
+		curpos = wpos;
+	    }
+	    if (nsgr > 0) {
+		out += "\033[";
+		for (auto i = 0u; i < nsgr; ++i)
+		    out.appendf ("%hhu;", sgr[i]);
+		out.back() = 'm';
+	    }
+	    if (get_bit (chattr, Surface::Attr::Altcharset))
+		out += char(15-get_bit (curcell.attr, Surface::Attr::Altcharset));
+	    out += curcell.c.c;
+	    if (++curpos.x > win.size().w) {
+		curpos.x = 0;
+		++curpos.y;
+	    }
+	    lastcell = curcell;
+	    *oci = *ici;
+	}
+    }
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Table-driven encoder, as used in TerminalScreen::draw_window
+
+static void encoder_repaint (string& out, Encoder& enc, Surface& scr, const Surface& win)
+{
+    for (dim_t y = 0; y < win.size().h; ++y) {
+	out.reserve (out.size() + win.size().w*Encoder::MaxCellBytes);
+	auto o = out.end();
+	auto oci = scr.iat (0, y);
+	auto ici = win.iat (0, y);
+	for (dim_t x = 0; x < win.size().w; ++x) {
+	    if (oci[x] == ici[x])
+		continue;
+	    // Runs of identical changed cells
+	    dim_t rn = 1;
+	    while (x+rn < win.size().w && ici[x+rn] == ici[x] && oci[x+rn] != ici[x])
+		++rn;
+	    o = enc.move_to (o, Point (x, y), scr);
+	    o = rn > 1 ? enc.write_run (o, ici[x], rn) : enc.write_cell (o, ici[x]);
+	    // The right half of a wide char is written with it
+	    if (rn == 1 && x+1 < win.size().w && enc.wrote_wide (Point (x, y)) && ici[x+1].c.is_wide_tail())
+		++rn;
+	    copy_n (&ici[x], rn, &oci[x]);
+	    x += rn-1;
+	}
+	out.shrink (o - out.begin());
+    }
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Scanning a mostly static screen
+
+static unsigned cellwise_scan (const Surface& scr, const Surface& win)
+{
+    auto nchanged = 0u;
+    for (auto oci = scr.begin(), ici = win.begin(); ici < win.end(); ++oci, ++ici)
+	nchanged += (*oci != *ici);
+    return nchanged;
+}
+
+static unsigned run_scan (const Surface& scr, const Surface& win)
+{
+    auto nchanged = 0u;
+    for (auto y = 0u; y < win.size().h; ++y) {
+	auto oci = scr.iat (0, y), ici = win.iat (0, y);
+	for (dim_t x = Surface::first_changed (oci, ici, win.size().w); x < win.size().w;) {
+	    auto xe = x + Surface::first_unchanged (oci+x, ici+x, win.size().w-x);
+	    nchanged += xe-x;
+	    x = xe + Surface::first_changed (oci+xe, ici+xe, win.size().w-xe);
+	}
+    }
+    return nchanged;
+}
+
+static unsigned compact_scan (const Surface& scr, const Surface& win)
+{
+    auto nchanged = 0u;
+    for (auto y = 0u; y < win.size().h; ++y) {
+	auto w = win.size().w;
+	for (dim_t x = scr.first_changed (Point (0, y), win, Point (0, y), w); x < w;) {
+	    auto xe = x + scr.first_unchanged (Point (x, y), win, Point (x, y), w-x);
+	    nchanged += xe-x;
+	    x = xe + scr.first_changed (Point (xe, y), win, Point (xe, y), w-xe);
+	}
+    }
+    return nchanged;
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ BenchApp
+
+class BenchApp : public AppL {
+public:
+    static auto& instance (void) { static BenchApp s_app; return s_app; }
+    int run (void);
+private:
+    BenchApp (void) : AppL() {}
+};
+
+int BenchApp::run (void)
+{
+    Surface win, scr;
+    win.resize (Size (c_BenchW, c_BenchH));
+    scr.resize (win.size());
+    fill_dashboard (win);
+    Encoder enc;
+    enc.set_screen_size (win.size());
+
+    string pout, eout;
+    auto t0 = nsnow();
+    for (auto i = 0u; i < c_BenchFrames; ++i) {
+	pout.clear();
+	scr.clear();
+	PrintfState pst;
+	printf_repaint (pout, scr, win, pst);
+    }
+    auto t1 = nsnow();
+    for (auto i = 0u; i < c_BenchFrames; ++i) {
+	eout.clear();
+	scr.clear();
+	enc.reset();
+	encoder_repaint (eout, enc, scr, win);
+    }
+    auto t2 = nsnow();
+
+    printf ("Full repaint of %ux%u, %u frames\n", c_BenchW, c_BenchH, c_BenchFrames);
+    printf ("    printf:  %6zu bytes/frame, %8.1f us/frame\n", pout.size(), (t1-t0)/1000.0/unsigned(c_BenchFrames));
+    printf ("    encoder: %6zu bytes/frame, %8.1f us/frame\n", eout.size(), (t2-t1)/1000.0/unsigned(c_BenchFrames));
+    printf ("    speedup: %.2fx, output %s\n", double(t1-t0)/(t2-t1), eout.size() <= pout.size() ? "no larger" : "LARGER");
+    auto fullok = eout.size() <= pout.size();
+
+    // Static screen with a ticking clock in the corner
+    scr = win;
+    auto clock = win.iat (c_BenchW-8, 0);
+    auto nc = 0u, nr = 0u;
+    t0 = nsnow();
+    for (auto i = 0u; i < c_BenchFrames; ++i) {
+	clock[i%8].c = char('0'+i%10);
+	nc += cellwise_scan (scr, win);
+    }
+    t1 = nsnow();
+    // Each scan starts with the clock as it was before the first
+    copy_n (scr.iat (c_BenchW-8, 0), 8, clock);
+    for (auto i = 0u; i < c_BenchFrames; ++i) {
+	clock[i%8].c = char('0'+i%10);
+	nr += run_scan (scr, win);
+    }
+    t2 = nsnow();
+    printf ("Static %ux%u screen scan, %u frames\n", c_BenchW, c_BenchH, c_BenchFrames);
+    printf ("    cellwise: %8.1f us/frame\n", (t1-t0)/1000.0/unsigned(c_BenchFrames));
+    printf ("    runs:     %8.1f us/frame\n", (t2-t1)/1000.0/unsigned(c_BenchFrames));
+    printf ("    speedup: %.2fx, changes %s\n", double(t1-t0)/(t2-t1), nc == nr ? "identical" : "DIFFERENT");
+
+    // The same scan on compact cells, half the size
+    Surface cscr, cwin;
+    cscr.set_format (Surface::Format::Compact);
+    cwin.set_format (Surface::Format::Compact);
+    cscr.resize (win.size());
+    cwin.resize (win.size());
+    copy_n (scr.iat (c_BenchW-8, 0), 8, clock);
+    for (dim_t y = 0; y < win.size().h; ++y) {
+	for (dim_t x = 0; x < win.size().w; ++x) {
+	    cscr.set_cell (x, y, scr.cell (x, y));
+	    cwin.set_cell (x, y, win.cell (x, y));
+	}
+    }
+    auto nk = 0u;
+    t0 = nsnow();
+    for (auto i = 0u; i < c_BenchFrames; ++i) {
+	clock[i%8].c = char('0'+i%10);
+	cwin.set_cell (c_BenchW-8+i%8, 0, clock[i%8]);
+	nk += compact_scan (cscr, cwin);
+    }
+    t1 = nsnow();
+    printf ("    compact:  %8.1f us/frame, changes %s\n", (t1-t0)/1000.0/unsigned(c_BenchFrames), nk == nr ? "identical" : "DIFFERENT");
+
+    // Sparse updates, a few scattered cells changing in each frame,
+    // where cursor movement is most of the output. The encoder output
+    // is also run through the emulator, after a full repaint, to check
+    // that the terminal would show the same screen.
+    auto pscr = win, escr = win;
+    PrintfState pst;
+    Emulator vt;
+    vt.resize (win.size());
+    eout.clear();
+    escr.clear();
+    enc.reset();
+    encoder_repaint (eout, enc, escr, win);
+    vt.write (eout.data(), eout.size());
+    auto vtseqs = vt.sequences();
+    size_t pbytes = 0, ebytes = 0;
+    uint64_t etime = 0;
+    for (auto i = 0u; i < c_BenchFrames; ++i) {
+	for (auto y = 0u; y < c_BenchH; y += 3)
+	    win.iat ((i*7 + y*13) % c_BenchW, y)->c = char('a'+i%26);
+	pout.clear();
+	printf_repaint (pout, pscr, win, pst);
+	pbytes += pout.size();
+	eout.clear();
+	t0 = nsnow();
+	encoder_repaint (eout, enc, escr, win);
+	etime += nsnow()-t0;
+	ebytes += eout.size();
+	vt.write (eout.data(), eout.size());
+    }
+    vtseqs = vt.sequences() - vtseqs;
+    auto nwrong = 0u;
+    auto vi = vt.surface().begin();
+    for (auto& wc : win)
+	nwrong += (*vi++ != wc);
+    printf ("Sparse updates of %ux%u, %u frames\n", c_BenchW, c_BenchH, c_BenchFrames);
+    printf ("    printf:  %6zu bytes/frame\n", pbytes/c_BenchFrames);
+    printf ("    encoder: %6zu bytes/frame, %5.1f sequences/frame, %8.1f us/frame\n",
+	    ebytes/c_BenchFrames, double(vtseqs)/unsigned(c_BenchFrames), etime/1000.0/unsigned(c_BenchFrames));
+    printf ("    emulated screen %s\n", nwrong ? "DIFFERENT" : "identical");
+
+    // A log scrolling between a title and a status row, as drawn by
+    // TerminalScreen::scroll_window: the screen is scrolled with DL,
+    // or IL every fourth frame, and only the exposed rows are drawn.
+    // A plain repaint of the same frames is the reference.
+    enum { c_LogTop = 2, c_LogBot = c_BenchH-2, c_LogStep = 3 };
+    Encoder senc;
+    senc.set_screen_size (win.size());
+    Surface sscr;
+    sscr.resize (win.size());
+    sscr.clear();
+    string sout;
+    encoder_repaint (sout, senc, sscr, win);
+    auto lenc = senc;
+    auto lscr = sscr;
+    Emulator svt;
+    svt.resize (win.size());
+    svt.write (sout.data(), sout.size());
+    size_t sbytes = 0, lbytes = 0;
+    auto nswrong = 0u;
+    for (auto i = 0u; i < c_BenchFrames; ++i) {
+	int n = i%4 == 3 ? -1 : c_LogStep;
+	scroll_log (win, c_LogTop, c_LogBot, n, i*c_LogStep);
+	sout.clear();
+	sout.reserve (Encoder::MaxCellBytes);
+	sout.shrink (senc.scroll (sout.begin(), c_LogTop, c_LogBot, n) - sout.begin());
+	sscr.scroll (c_LogTop, c_LogBot, n);
+	// Only the exposed rows are left to draw
+	nswrong += cellwise_scan (sscr, win) > unsigned(abs(n))*c_BenchW;
+	encoder_repaint (sout, senc, sscr, win);
+	sbytes += sout.size();
+	svt.write (sout.data(), sout.size());
+	auto svi = svt.surface().begin();
+	for (auto& wc : win)
+	    nswrong += (*svi++ != wc);
+	eout.clear();
+	encoder_repaint (eout, lenc, lscr, win);
+	lbytes += eout.size();
+    }
+    printf ("Scrolling log of %ux%u, %u frames\n", c_BenchW, c_BenchH, c_BenchFrames);
+    printf ("    repaint: %6zu bytes/frame\n", lbytes/c_BenchFrames);
+    printf ("    scroll:  %6zu bytes/frame, screen %s\n", sbytes/c_BenchFrames, nswrong ? "DIFFERENT" : "identical");
+
+    // The shift scroll_window finds from row hashes, and the DL or IL
+    // written for it, for a log moved up, one moved down, and one with
+    // no rows matching the screen, which is repainted instead.
+    Surface hscr, hwin;
+    hscr.resize (win.size());
+    hwin.resize (win.size());
+    fill_dashboard (hscr);
+    auto nhwrong = 0u;
+    static constexpr const int c_shifts[] = { c_LogStep, -2, 0 };
+    for (auto n : c_shifts) {
+	if (n) {
+	    hwin = hscr;
+	    scroll_log (hwin, c_LogTop, c_LogBot, n, 0);
+	} else
+	    fill_wide (hwin, 0);
+	auto d = TerminalScreen::scroll_shift (hscr, 0, hwin, c_LogTop, c_LogBot);
+	string hout, hseq;
+	if (d) {
+	    Encoder henc;
+	    henc.set_screen_size (win.size());
+	    hout.reserve (Encoder::MaxCellBytes);
+	    hout.shrink (henc.scroll (hout.begin(), c_LogTop, c_LogBot, d) - hout.begin());
+	}
+	if (n)
+	    hseq.appendf ("\033[%d%c", abs(n), n < 0 ? 'L' : 'M');
+	auto seqok = !n || strstr (hout.c_str(), hseq.c_str());
+	nhwrong += d != n || !seqok;
+	printf ("    shift %2d: found %2d, %s\n", n, d, !d ? "repainted" : (!seqok ? "WRONG SEQUENCE" : (d < 0 ? "with IL" : "with DL")));
+    }
+
+    // Wide chars and combining marks, drawn in full, and then over
+    // each other, shifted by a column in each frame. Each wide char
+    // is written with its right half, or the terminal would erase it.
+    Encoder wenc;
+    wenc.set_screen_size (win.size());
+    Surface wscr;
+    wscr.resize (win.size());
+    wscr.clear();
+    Emulator wvt;
+    wvt.resize (win.size());
+    size_t wbytes = 0;
+    auto nwwrong = 0u;
+    for (auto i = 0u; i < c_BenchFrames; ++i) {
+	fill_wide (win, i);
+	eout.clear();
+	encoder_repaint (eout, wenc, wscr, win);
+	wbytes += eout.size();
+	wvt.write (eout.data(), eout.size());
+	auto wvi = wvt.surface().begin();
+	for (auto& wc : win)
+	    nwwrong += (*wvi++ != wc);
+    }
+    printf ("Wide and combining chars on %ux%u, %u frames\n", c_BenchW, c_BenchH, c_BenchFrames);
+    printf ("    encoder: %6zu bytes/frame, emulated screen %s\n", wbytes/c_BenchFrames, nwwrong ? "DIFFERENT" : "identical");
+
+    // Frames and bars, written as runs on terminals with REP, ECH, EL,
+    // and back color erase, and checked on the emulator.
+    fill_frames (win);
+    Encoder renc;
+    renc.set_screen_size (win.size());
+    renc.set_caps (Encoder::DefaultCaps | 1u << Encoder::Cap::RepeatChar | 1u << Encoder::Cap::EraseChars
+		    | 1u << Encoder::Cap::ClearToEol | 1u << Encoder::Cap::BackColorErase);
+    eout.clear();
+    escr.clear();
+    enc.reset();
+    encoder_repaint (eout, enc, escr, win);
+    string rout;
+    Surface rscr;
+    rscr.resize (win.size());
+    rscr.clear();
+    encoder_repaint (rout, renc, rscr, win);
+    Emulator rvt;
+    rvt.resize (win.size());
+    rvt.write (rout.data(), rout.size());
+    auto nrwrong = 0u;
+    auto rvi = rvt.surface().begin();
+    for (auto& wc : win) {
+	nrwrong += (!(rvi->c == wc.c) || rvi->bgc() != wc.bgc());
+	++rvi;
+    }
+    printf ("Frames and bars of %ux%u\n", c_BenchW, c_BenchH);
+    printf ("    cells:   %6zu bytes\n", eout.size());
+    printf ("    runs:    %6zu bytes, emulated screen %s\n", rout.size(), nrwrong ? "DIFFERENT" : "identical");
+
+    // The last column of a row changes, and the next row is erased,
+    // with the cursor waiting to wrap when the erase is written.
+    fill_dashboard (win);
+    rout.clear();
+    encoder_repaint (rout, renc, rscr, win);
+    rvt.write (rout.data(), rout.size());
+    auto nlwrong = 0u;
+    for (dim_t y = 0; y+1 < c_BenchH; y += 2) {
+	win.iat (c_BenchW-1, y)->c = char('a'+y%26);
+	for (auto c = win.iat (0, y+1), ce = c+c_BenchW; c < ce; ++c)
+	    *c = Surface::default_cell();
+	rout.clear();
+	encoder_repaint (rout, renc, rscr, win);
+	rvt.write (rout.data(), rout.size());
+	rvi = rvt.surface().begin();
+	for (auto& wc : win) {
+	    nlwrong += (!(rvi->c == wc.c) || rvi->bgc() != wc.bgc());
+	    ++rvi;
+	}
+    }
+    printf ("Last column, then an erased row, on %ux%u\n", c_BenchW, c_BenchH);
+    printf ("    emulated screen %s\n", nlwrong ? "DIFFERENT" : "identical");
+    return fullok && nc == nr && nk == nr && ebytes <= pbytes && !nwrong && sbytes < lbytes && !nswrong && !nhwrong && !nwwrong && rout.size() < eout.size() && !nrwrong && !nlwrong ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+CWICLO_APP_L (BenchApp,)
+
+//}}}-------------------------------------------------------------------
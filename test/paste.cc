@@ -0,0 +1,131 @@
+// This file is part of the cwiclui project
+//
+// Copyright (c) 2021 by Mike Sharov <msharov@users.sourceforge.net>
+// This file is free software, distributed under the ISC License.
+
+#include "../window.h"
+#include "../termscr.h"
+#include <fcntl.h>
+#include <sys/ioctl.h>
+using namespace cwiclui;
+
+// An edit box, where pastes larger than it can hold are clipped
+class PasteWindow : public Window {
+public:
+    explicit PasteWindow (Msg::Link l);
+    void on_selection (widgetid_t id, unsigned f, unsigned l) override;
+private:
+    enum : widgetid_t { wid_Edit = wid_First };
+    static constexpr const Layout c_layout[] = {
+	WL_(Editbox, wid_Edit)
+    };
+};
+
+PasteWindow::PasteWindow (Msg::Link l)
+: Window(l)
+{
+    create_widgets (c_layout);
+    set_widget_text (wid_Edit, "ab");
+}
+
+void PasteWindow::on_selection (widgetid_t id, unsigned f, unsigned l)
+{
+    // The cursor moves to the end of the paste
+    auto& t = widget_by_id (id)->text();
+    auto nbad = 0u;
+    for (auto i = 2u; i+1 < t.size(); i += 2)
+	nbad += t[i] != '\xc3' || t[i+1] != '\xa9';
+    printf ("Pasted into %u bytes, %u not as pasted, cursor at %u\n", unsigned(t.size()), nbad, f);
+    Window::on_selection (id, f, l);
+    close();
+}
+
+//{{{ TestApp ----------------------------------------------------------
+
+// Opens the window on a pty, and when it is shown, pastes 40000 bytes
+// of two byte chars into it, more than the cursor position can reach.
+class TestApp : public AppL {
+    IMPLEMENT_INTERFACES_I (AppL,,(ITimer))
+public:
+    static auto& instance (void) { static TestApp s_app; return s_app; }
+    int run (void);
+    void Timer_timer (fd_t fd);
+    void on_msger_destroyed (mrid_t mid) override;
+private:
+    TestApp (void) : AppL(),_scr(),_vt(),_paste(),_pasted(),_master(-1),_slave(-1),_pread (mrid_App),_pwrite (mrid_App),_pwin (mrid_App) {}
+private:
+    TerminalScreen*	_scr;
+    TerminalScreen::Emulator _vt;
+    string		_paste;	// What is still to be written to the pty
+    bool		_pasted;
+    fd_t		_master;
+    fd_t		_slave;
+    ITimer		_pread;
+    ITimer		_pwrite;
+    Interface		_pwin;
+};
+
+IMPLEMENT_INTERFACES_D (TestApp)
+
+int TestApp::run (void)
+{
+    struct winsize ws = {};
+    ws.ws_col = 40;
+    ws.ws_row = 3;
+    _master = posix_openpt (O_RDWR| O_NOCTTY);
+    if (_master < 0 || grantpt (_master) || unlockpt (_master) || ioctl (_master, TIOCSWINSZ, &ws)
+	    || 0 > (_slave = open (ptsname (_master), O_RDWR| O_NOCTTY))) {
+	perror ("pty");
+	return EXIT_FAILURE;
+    }
+    make_fd_nonblocking (_master);
+    _vt.resize (Size (ws.ws_col, ws.ws_row));
+    _scr = new TerminalScreen (_slave, _slave, "xterm");
+    _pwin.create_dest_as<PasteWindow>();
+    _scr->add_client (_pwin.dest());
+    _pread.wait_read (_master);
+    return AppL::run();
+}
+
+void TestApp::Timer_timer (fd_t)
+{
+    char buf [256];
+    for (ssize_t br; 0 < (br = read (_master, buf, sizeof(buf)));)
+	_vt.write (buf, br);
+    // Pasted when the window is drawn, since the screen reads only in UI mode
+    if (auto t = _vt.text(); !_pasted && strstr (t.c_str(), "ab")) {
+	_pasted = true;
+	_paste = "\033[200~";
+	for (auto i = 0u; i < 20000; ++i)
+	    _paste += "\xc3\xa9";
+	_paste += "\033[201~";
+    }
+    // The pty holds only a few KB, and is read by the screen in this
+    // process, so the paste is written as it makes room.
+    if (!_paste.empty()) {
+	if (auto bw = write (_master, _paste.data(), _paste.size()); bw > 0)
+	    _paste.erase (_paste.begin(), bw);
+	if (!_paste.empty())
+	    _pwrite.wait_write (_master);
+    }
+    _pread.wait_read (_master);
+}
+
+void TestApp::on_msger_destroyed (mrid_t mid)
+{
+    if (mid == _pwin.dest()) {
+	_pread.stop();
+	_pwrite.stop();
+	delete _scr;
+	_scr = nullptr;
+	close (_slave);
+	close (_master);
+	quit();
+    }
+    AppL::on_msger_destroyed (mid);
+}
+
+CWICLO_APP_L (TestApp, (App::Timer)(TerminalScreenWindow))
+SET_WIDGET_FACTORY (Widget::default_factory)
+
+//}}}-------------------------------------------------------------------
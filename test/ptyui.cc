@@ -0,0 +1,169 @@
+// This file is part of the cwiclui project
+//
+// Copyright (c) 2021 by Mike Sharov <msharov@users.sourceforge.net>
+// This file is free software, distributed under the ISC License.
+
+#include "../cdlgs.h"
+#include "../termscr.h"
+#include <fcntl.h>
+#include <sys/ioctl.h>
+using namespace cwiclui;
+
+// Shows the size of the screen it is on, and asks before quitting
+class PtyWindow : public Window {
+    IMPLEMENT_INTERFACES_I (Window,,(IMessageBox))
+public:
+    explicit PtyWindow (Msg::Link l) : Window(l),_quitbox (l.dest) {}
+    void MessageBox_reply (IMessageBox::Answer a);
+private:
+    DECLARE_WIDGET_WRITE_DRAWLIST (Drawlist);
+    void on_key (key_t k) override;
+private:
+    IMessageBox	_quitbox;
+};
+
+IMPLEMENT_INTERFACES_D (PtyWindow)
+
+DEFINE_WIDGET_WRITE_DRAWLIST (PtyWindow, Drawlist, dlw)
+{
+    string t;
+    t.appendf ("%ux%u console", area().w, area().h);
+    dlw.move_to (0, 0);
+    dlw.text (t);
+    dlw.move_to (0, area().h-1);
+    dlw.text ("q to quit");
+}
+
+void PtyWindow::on_key (key_t k)
+{
+    // The dialog must open on the same pty as this window
+    if (k == 'q')
+	return _quitbox.ask ("Quit?", IMessageBox::Type::YesNo, window_id());
+    Window::on_key (k);
+}
+
+void PtyWindow::MessageBox_reply (IMessageBox::Answer a)
+{
+    if (a == IMessageBox::Answer::Yes)
+	close();
+}
+
+//{{{ TestApp ----------------------------------------------------------
+
+// Opens a window on each of several ptys, all driven by this process.
+// The pty output goes into an emulator for each, and when every window
+// is shown, the screens are printed and the windows told to quit. The
+// quit dialogs must then be shown on the same ptys, and are answered.
+class TestApp : public AppL {
+    IMPLEMENT_INTERFACES_I (AppL,,(ITimer))
+public:
+    enum { NConsoles = 3 };
+    using Emulator = TerminalScreen::Emulator;
+public:
+    static auto& instance (void) { static TestApp s_app; return s_app; }
+    int run (void);
+    void Timer_timer (fd_t fd);
+    void on_msger_destroyed (mrid_t mid) override;
+private:
+    struct Console {
+			Console (void) : scr(),vt(),shown(),asked(),master(-1),slave(-1),pread (mrid_App),pwin (mrid_App) {}
+	TerminalScreen*	scr;
+	Emulator	vt;
+	string		shown;	// Screen text when the window was drawn
+	bool		asked;	// The quit dialog was drawn
+	fd_t		master;
+	fd_t		slave;
+	ITimer		pread;
+	Interface	pwin;
+    };
+private:
+    TestApp (void) : AppL(),_cons(),_nshown(),_nasked(),_nclosed() {}
+private:
+    Console	_cons [NConsoles];
+    unsigned	_nshown;
+    unsigned	_nasked;
+    unsigned	_nclosed;
+};
+
+IMPLEMENT_INTERFACES_D (TestApp)
+
+int TestApp::run (void)
+{
+    for (auto i = 0u; i < size(_cons); ++i) {
+	auto& c = _cons[i];
+	// Each pty has a different size, to show which screen a window is on
+	struct winsize ws = {};
+	ws.ws_col = 30+4*i;
+	ws.ws_row = 5+i;
+	c.master = posix_openpt (O_RDWR| O_NOCTTY);
+	if (c.master < 0 || grantpt (c.master) || unlockpt (c.master) || ioctl (c.master, TIOCSWINSZ, &ws)
+		|| 0 > (c.slave = open (ptsname (c.master), O_RDWR| O_NOCTTY))) {
+	    perror ("pty");
+	    return EXIT_FAILURE;
+	}
+	make_fd_nonblocking (c.master);
+	c.vt.resize (Size (ws.ws_col, ws.ws_row));
+	c.scr = new TerminalScreen (c.slave, c.slave, "xterm");
+	c.pwin.create_dest_as<PtyWindow>();
+	c.scr->add_client (c.pwin.dest());
+	c.pread.wait_read (c.master);
+    }
+    return AppL::run();
+}
+
+void TestApp::Timer_timer (fd_t fd)
+{
+    for (auto& c : _cons) {
+	if (c.master != fd)
+	    continue;
+	char buf [256];
+	for (ssize_t br; 0 < (br = read (fd, buf, sizeof(buf)));)
+	    c.vt.write (buf, br);
+	// The bottom row is drawn last
+	if (auto t = c.vt.text(); c.shown.empty() && strstr (t.c_str(), "q to quit")) {
+	    c.shown = move (t);
+	    ++_nshown;
+	} else if (!c.shown.empty() && !c.asked && strstr (t.c_str(), "Quit?")) {
+	    c.asked = true;
+	    ++_nasked;
+	}
+	c.pread.wait_read (fd);
+    }
+    if (_nshown == size(_cons)) {
+	_nshown = 0;
+	for (auto i = 0u; i < size(_cons); ++i) {
+	    printf ("Console %u:\n%s", i+1, _cons[i].shown.c_str());
+	    write (_cons[i].master, "q", 1);
+	}
+    }
+    if (_nasked == size(_cons)) {
+	_nasked = 0;
+	for (auto i = 0u; i < size(_cons); ++i) {
+	    printf ("Console %u: quit dialog shown\n", i+1);
+	    write (_cons[i].master, "y", 1);
+	}
+    }
+}
+
+void TestApp::on_msger_destroyed (mrid_t mid)
+{
+    for (auto& c : _cons)
+	if (c.pwin.dest() == mid)
+	    ++_nclosed;
+    if (_nclosed == size(_cons)) {
+	for (auto& c : _cons) {
+	    c.pread.stop();
+	    delete c.scr;
+	    c.scr = nullptr;
+	    close (c.slave);
+	    close (c.master);
+	}
+	quit();
+    }
+    AppL::on_msger_destroyed (mid);
+}
+
+CWICLO_APP_L (TestApp, (App::Timer)(TerminalScreenWindow)(MessageBox))
+SET_WIDGET_FACTORY (Widget::default_factory)
+
+//}}}-------------------------------------------------------------------
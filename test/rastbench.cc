@@ -0,0 +1,151 @@
+// This file is part of the cwiclui project
+//
+// Copyright (c) 2021 by Mike Sharov <msharov@users.sourceforge.net>
+// This file is free software, distributed under the ISC License.
+
+#include "../rastscr.h"
+#include <time.h>
+using namespace cwiclui;
+
+//{{{ Test drawlist ----------------------------------------------------
+
+using Canvas	= RasterScreen::Canvas;
+using Renderer	= RasterScreen::Renderer;
+using PanelType	= Drawlist::PanelType;
+
+enum { c_BenchW = 1280, c_BenchH = 720, c_BenchFrames = 100 };
+
+static uint64_t nsnow (void)
+{
+    struct timespec t;
+    clock_gettime (CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1000000000ull + t.tv_nsec;
+}
+
+// A dialog-like frame: panels, boxes, lines, text in a redefined
+// palette, and a field of small bars, to cover each command.
+template <typename S>
+static void write_frame (DrawlistGraphic::Writer<S>& dlw)
+{
+    static constexpr const colray_t c_pal[] = {
+	0x20,0x24,0x30,	0x40,0x60,0xa0,	0xe0,0xe0,0xd0,	0xf0,0xa0,0x20
+    };
+    enum : icolor_t { Desktop = 32, Title, Label, Accent };
+    dlw.palette3 (c_pal, Desktop);
+    dlw.define_color (IColor::Gray, RGB (0xc0,0xc0,0xc0));
+    dlw.fill_color (Desktop);
+    dlw.clear();
+
+    // Title bar and status bar
+    dlw.fill_color (Title);
+    dlw.move_to (0, 0);
+    dlw.bar (c_BenchW, 2*RasterScreen::GlyphH);
+    dlw.draw_color (Label);
+    dlw.move_to (c_BenchW/2, RasterScreen::GlyphH);
+    dlw.text ("Rasterizer throughput", HAlign::Center, VAlign::Center);
+    dlw.draw_color (IColor::Black);
+    dlw.fill_color (IColor::Gray);
+    dlw.move_to (0, c_BenchH-unsigned(RasterScreen::GlyphH)-4);
+    dlw.panel (c_BenchW, RasterScreen::GlyphH+4, PanelType::Statusbar);
+
+    // Buttons and check boxes
+    for (auto i = 0u; i < 8; ++i) {
+	dlw.fill_color (IColor::Gray);
+	dlw.draw_color (IColor::Black);
+	dlw.move_to (20+i*150, 40);
+	dlw.panel (130, 24, i%2 ? PanelType::ButtonOn : PanelType::Button);
+	dlw.move_to (20+i*150+65, 52);
+	dlw.text ("Button", HAlign::Center, VAlign::Center);
+	dlw.move_to (20+i*150, 80);
+	dlw.panel (RasterScreen::GlyphH, RasterScreen::GlyphH, i%2 ? PanelType::CheckboxOn : PanelType::Checkbox);
+    }
+
+    // A grid of lines and boxes
+    dlw.draw_color (Accent);
+    for (auto x = 20; x < c_BenchW/2; x += 20) {
+	dlw.move_to (x, 110);
+	dlw.vline (300);
+    }
+    for (auto y = 110; y < 410; y += 20) {
+	dlw.move_to (20, y);
+	dlw.hline (c_BenchW/2-40);
+    }
+    dlw.move_to (20, 110);
+    dlw.line (c_BenchW/2-40, 300);
+    dlw.box (Rect (10, 100, c_BenchW/2-20, 320));
+
+    // Bars in many colors, and text over them
+    for (auto y = 0u; y < 24; ++y) {
+	for (auto x = 0u; x < 16; ++x) {
+	    dlw.fill_color (icolor_t (16+(x+y*16)%216));
+	    dlw.bar (Rect (c_BenchW/2+x*38, 110+y*12, 36, 10));
+	}
+    }
+    dlw.draw_color (IColor::White);
+    for (auto y = 0u; y < 20; ++y) {
+	dlw.move_to (20, 430+y*RasterScreen::GlyphH);
+	dlw.text ("The quick brown fox jumps over the lazy dog. 0123456789 !@#$%^&*() <>[]{}");
+    }
+    dlw.move_to (c_BenchW/2, 430);
+    dlw.char_bar (Size (c_BenchW/2-20, 4*RasterScreen::GlyphH), Drawlist::GChar::Checkerboard);
+}
+
+static memblock frame_drawlist (void)
+{
+    DrawlistGraphic::Writer<sstream> dlss;
+    write_frame (dlss);
+    memblock dl (dlss.size());
+    DrawlistGraphic::Writer<ostream> dlos (ostream (dl.data(), dl.size()));
+    write_frame (dlos);
+    return dl;
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ BenchApp
+
+class BenchApp : public AppL {
+public:
+    static auto& instance (void) { static BenchApp s_app; return s_app; }
+    int run (void);
+private:
+    BenchApp (void) : AppL() {}
+};
+
+int BenchApp::run (void)
+{
+    Canvas c;
+    c.resize (Size (c_BenchW, c_BenchH));
+    const double npixels = unsigned(c_BenchW)*c_BenchH*c_BenchFrames;
+
+    // Span fills alone, the limit for bars and clears
+    auto t0 = nsnow();
+    for (auto f = 0u; f < c_BenchFrames; ++f)
+	c.fill (Rect (c.size()), RGB (f,f,f));
+    auto t1 = nsnow();
+    printf ("Span fills of %ux%u, %u frames\n", c_BenchW, c_BenchH, c_BenchFrames);
+    printf ("    %8.1f us/frame, %8.1f Mpixels/s\n", (t1-t0)/1000.0/unsigned(c_BenchFrames), npixels*1000/(t1-t0));
+
+    // Whole drawlists
+    auto dl = frame_drawlist();
+    Renderer r (c);
+    t0 = nsnow();
+    for (auto f = 0u; f < c_BenchFrames; ++f)
+	r.draw (dl);
+    t1 = nsnow();
+    printf ("Drawlist of %zu bytes on %ux%u, %u frames\n", dl.size(), c_BenchW, c_BenchH, c_BenchFrames);
+    printf ("    %8.1f us/frame, %8.1f Mpixels/s\n", (t1-t0)/1000.0/unsigned(c_BenchFrames), npixels*1000/(t1-t0));
+
+    // Snapshots, to look at what was measured
+    static constexpr const char* c_snapshots[] = { "/tmp/rastbench.ppm", "/tmp/rastbench.png" };
+    for (auto s : c_snapshots) {
+	t0 = nsnow();
+	auto ok = s[strlen(s)-1] == 'g' ? c.write_png (s) : c.write_ppm (s);
+	t1 = nsnow();
+	printf ("    %s: %s in %.1f ms\n", s, ok ? "written" : "FAILED", (t1-t0)/1e6);
+    }
+    return EXIT_SUCCESS;
+}
+
+CWICLO_APP_L (BenchApp,)
+
+//}}}-------------------------------------------------------------------
@@ -0,0 +1,457 @@
+// This file is part of the cwiclui project
+//
+// Copyright (c) 2021 by Mike Sharov <msharov@users.sourceforge.net>
+// This file is free software, distributed under the ISC License.
+
+#include "../termscr.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+using namespace cwiclui;
+
+// Replays a recording made with TerminalScreen::record, sending each
+// recorded window's drawlists to the screen as fast as it composes
+// them, or with -t, at the recorded times. Without a recording file,
+// a generated one is replayed. With -a, the replay's terminal output
+// is written to the given file in asciicast v2 format.
+//
+// Usage: replaybench [-t] [-a cast_file] [recording]
+
+using Recorder	= TerminalScreen::Recorder;
+
+static uint64_t nsnow (void)
+{
+    struct timespec t;
+    clock_gettime (CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1000000000ull + t.tv_nsec;
+}
+
+//{{{ Generated recording ----------------------------------------------
+
+enum { c_ReplayW = 120, c_ReplayH = 40, c_ReplayFrames = 300 };
+
+// A full screen dashboard with bars growing with the frame number
+template <typename S>
+static void write_dashboard (Drawlist::Writer<S>& dlw, unsigned f)
+{
+    dlw.viewport (Rect (0, 0, c_ReplayW, c_ReplayH));
+    dlw.draw_color (IColor::Default);
+    dlw.fill_color (IColor::Default);
+    dlw.clear();
+    dlw.box (Rect (0, 0, c_ReplayW, c_ReplayH));
+    for (auto y = 2u; y < c_ReplayH-2; y += 2) {
+	string t;
+	t.appendf ("%2u cpu %3u%%", y/2, (f*7+y*13) % 100);
+	dlw.move_to (2, y);
+	dlw.text (t);
+	auto w = dim_t ((f+y*5) % (c_ReplayW-16));
+	dlw.fill_color (icolor_t (IColor::Gray0 + y%8));
+	dlw.bar (Rect (14, y, w, 1));
+	dlw.char_bar (Rect (14+w, y, c_ReplayW-16-w, 1), Drawlist::GChar::Checkerboard);
+    }
+}
+
+// A small dialog on top, updated every few frames
+template <typename S>
+static void write_popup (Drawlist::Writer<S>& dlw, unsigned f)
+{
+    dlw.viewport (Rect (0, 0, 40, 6));
+    dlw.fill_color (IColor::Blue);
+    dlw.bar (Rect (0, 0, 40, 6));
+    dlw.box (Rect (0, 0, 40, 6));
+    string t;
+    t.appendf ("Frame %u", f);
+    dlw.move_to (20, 3);
+    dlw.text (t, HAlign::Center, VAlign::Center);
+}
+
+template <typename F>
+static void record_draw (Recorder& rec, uint16_t id, F write_frame)
+{
+    Drawlist::Writer<sstream> dlss;
+    write_frame (dlss);
+    memblock dl (dlss.size());
+    Drawlist::Writer<ostream> dlos (ostream (dl.data(), dl.size()));
+    write_frame (dlos);
+    rec.write (Recorder::Type::Draw, id, dl.data(), dl.size());
+}
+
+static bool generate_recording (const char* filename)
+{
+    Recorder rec;
+    if (!rec.open (filename))
+	return false;
+    Size scrsz (c_ReplayW, c_ReplayH);
+    rec.write (Recorder::Type::Screen, 0, &scrsz, sizeof(scrsz));
+    enum : uint16_t { DashboardId = 1, PopupId };
+    WindowInfo dashinfo (WindowInfo::Type::Normal, Rect());
+    rec.write (Recorder::Type::Open, DashboardId, &dashinfo, sizeof(dashinfo));
+    WindowInfo popinfo (WindowInfo::Type::Dialog, Rect (0, 0, 40, 6));
+    rec.write (Recorder::Type::Open, PopupId, &popinfo, sizeof(popinfo));
+    for (auto f = 0u; f < c_ReplayFrames && rec.is_open(); ++f) {
+	record_draw (rec, DashboardId, [&](auto& dlw) { write_dashboard (dlw, f); });
+	if (f % 4 == 0)
+	    record_draw (rec, PopupId, [&](auto& dlw) { write_popup (dlw, f); });
+    }
+    return rec.is_open();
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Reading recordings
+
+struct RecordedFrame {
+    uint64_t		time;
+    uint32_t		offset;	// of the data in the recording
+    uint32_t		size;
+    Recorder::Type	type;
+    uint16_t		id;
+};
+
+static bool read_recording (const char* filename, memblock& data, vector<RecordedFrame>& frames)
+{
+    auto fd = open (filename, O_RDONLY| O_CLOEXEC);
+    if (fd < 0)
+	return false;
+    struct stat st;
+    if (!fstat (fd, &st)) {
+	data.resize (st.st_size);
+	size_t nr = 0;
+	for (ssize_t br; nr < data.size() && 0 < (br = read (fd, data.data()+nr, data.size()-nr));)
+	    nr += br;
+	data.shrink (nr);
+    }
+    close (fd);
+    if (data.size() < sizeof(Recorder::c_Magic) || memcmp (data.data(), Recorder::c_Magic, sizeof(Recorder::c_Magic)))
+	return false;
+    frames.clear();
+    for (size_t o = sizeof(Recorder::c_Magic); o + sizeof(Recorder::Header) <= data.size();) {
+	Recorder::Header h;
+	memcpy (&h, data.data()+o, sizeof(h));
+	o += sizeof(h);
+	if (h.size > data.size()-o)
+	    break;	// truncated last record
+	frames.push_back (RecordedFrame { h.time, uint32_t(o), h.size, h.type, h.id });
+	o += h.size;
+    }
+    return true;
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Asciicast output
+
+// Returns how many bytes of p do not end in an incomplete UTF-8 character
+static size_t utf8_complete (const char* p, size_t n)
+{
+    for (size_t i = n, ntail = 0; i && ntail < 4; ++ntail) {
+	auto c = uint8_t(p[--i]);
+	if ((c & 0xc0) == 0x80)
+	    continue;	// continuation byte
+	size_t clen = c < 0xc0 ? 1 : c < 0xe0 ? 2 : c < 0xf0 ? 3 : 4;
+	return clen > ntail+1 ? i : n;
+    }
+    return n;
+}
+
+static void write_json_string (FILE* f, const char* p, size_t n)
+{
+    fputc ('"', f);
+    for (auto i = 0u; i < n; ++i) {
+	auto c = uint8_t(p[i]);
+	if (c == '"' || c == '\\')
+	    fprintf (f, "\\%c", c);
+	else if (c == '\n')
+	    fputs ("\\n", f);
+	else if (c == '\r')
+	    fputs ("\\r", f);
+	else if (c < ' ' || c == 0x7f)
+	    fprintf (f, "\\u%04x", c);
+	else
+	    fputc (c, f);
+    }
+    fputc ('"', f);
+}
+
+// Writes the output records of a recording as an asciicast v2 file
+static bool write_asciicast (const char* recfile, const char* castfile)
+{
+    memblock data;
+    vector<RecordedFrame> frames;
+    if (!read_recording (recfile, data, frames))
+	return false;
+    auto f = fopen (castfile, "w");
+    if (!f)
+	return false;
+    Size scrsz (80, 24);
+    for (auto& r : frames) {
+	if (r.type == Recorder::Type::Screen && r.size == sizeof(scrsz)) {
+	    memcpy (&scrsz, data.data()+r.offset, sizeof(scrsz));
+	    break;
+	}
+    }
+    fprintf (f, "{\"version\": 2, \"width\": %u, \"height\": %u, \"env\": {\"TERM\": \"xterm-256color\"}}\n", scrsz.w, scrsz.h);
+    // Output is written in pieces that may split UTF-8 characters,
+    // but each event must be valid UTF-8, so tails are carried over.
+    string pending;
+    for (auto& r : frames) {
+	if (r.type != Recorder::Type::Output)
+	    continue;
+	pending.append (data.data()+r.offset, r.size);
+	auto n = utf8_complete (pending.data(), pending.size());
+	if (!n)
+	    continue;
+	fprintf (f, "[%.6f, \"o\", ", r.time/1e9);
+	write_json_string (f, pending.data(), n);
+	fputs ("]\n", f);
+	pending.erase (pending.begin(), n);
+    }
+    return !fclose (f);
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ ReplayWindow
+
+// Sends the recorded drawlists of one window to its screen
+class ReplayWindow : public Msger {
+    IMPLEMENT_INTERFACES_I (Msger,,(IScreen)(ITimer))
+public:
+    explicit		ReplayWindow (Msg::Link l);
+    void		Screen_event (const Event& ev);
+    void		Screen_expose (void)			{}
+    void		Screen_resize (const WindowInfo&)	{}
+    void		Screen_screen_info (const ScreenInfo&)	{}
+    void		Screen_clipboard (const Event&, const string_view&) {}
+    void		Timer_timer (fd_t)			{ send_next(); }
+    void		on_msger_destroyed (mrid_t mid) override;
+private:
+    void		send_next (void);
+    void		close (void)	{ _scr.close(); set_unused(); }
+private:
+    IScreen		_scr;
+    ITimer		_ptimer;
+    uint16_t		_recid;	// Window id in the recording
+    uint32_t		_next;	// Index of the next frame to send
+};
+
+IMPLEMENT_INTERFACES_D (ReplayWindow)
+
+//}}}-------------------------------------------------------------------
+//{{{ ReplayApp
+
+class ReplayApp : public AppL {
+public:
+    enum { MaxWindows = 16 };
+public:
+    static auto& instance (void) { static ReplayApp s_app; return s_app; }
+    void process_args (int argc, char* const* argv);
+    int run (void);
+    void on_msger_destroyed (mrid_t mid) override;
+    uint16_t recorded_id (mrid_t mid) const;
+    uint16_t take_recorded_id (void)			{ return _replays[_ncreated++].recid; }
+    const RecordedFrame* next_frame (uint16_t recid, uint32_t& i) const;
+    auto frame_data (const RecordedFrame& f) const	{ return _data.data() + f.offset; }
+    uint64_t frame_due (const RecordedFrame& f) const	{ return _timed ? _start + f.time : 0; }
+    void count_drawlist (void)				{ ++_ndrawlists; }
+private:
+    struct Replay {
+			Replay (void) : pwin (mrid_App),recid() {}
+	Interface	pwin;
+	uint16_t	recid;
+    };
+private:
+    ReplayApp (void) : AppL(),_data(),_frames(),_replays(),_nreplays(),_ncreated(),_nclosed(),_ndrawlists()
+			,_recfile(),_castfile(),_timed(),_start(),_tmprec(),_tmpcast() {}
+private:
+    memblock		_data;
+    vector<RecordedFrame> _frames;
+    Replay		_replays [MaxWindows];
+    unsigned		_nreplays;
+    unsigned		_ncreated;
+    unsigned		_nclosed;
+    unsigned		_ndrawlists;
+    const char*		_recfile;
+    const char*		_castfile;
+    bool		_timed;
+    uint64_t		_start;
+    char		_tmprec [32];
+    char		_tmpcast [32];
+};
+
+void ReplayApp::process_args (int argc, char* const* argv)
+{
+    for (int opt; 0 < (opt = getopt (argc, argv, "ta:"));) {
+	if (opt == 't')
+	    _timed = true;
+	else if (opt == 'a')
+	    _castfile = optarg;
+	else {
+	    fprintf (stderr, "Usage: replaybench [-t] [-a cast_file] [recording]\n");
+	    exit (EXIT_FAILURE);
+	}
+    }
+    if (optind < argc)
+	_recfile = argv[optind];
+}
+
+static bool make_temp_file (char* name, size_t n)
+{
+    snprintf (name, n, "/tmp/replay.XXXXXX");
+    auto fd = mkstemp (name);
+    if (fd < 0)
+	return false;
+    close (fd);
+    return true;
+}
+
+int ReplayApp::run (void)
+{
+    if (!_recfile) {
+	if (!make_temp_file (_tmprec, sizeof(_tmprec)) || !generate_recording (_tmprec)) {
+	    perror ("generating recording");
+	    return EXIT_FAILURE;
+	}
+	_recfile = _tmprec;
+    }
+    auto loaded = read_recording (_recfile, _data, _frames);
+    if (_recfile == _tmprec)
+	unlink (_tmprec);
+    if (!loaded) {
+	fprintf (stderr, "%s: not a recording\n", _recfile);
+	return EXIT_FAILURE;
+    }
+
+    // The headless screen is sized from the environment
+    for (auto& f : _frames) {
+	if (f.type == Recorder::Type::Screen && f.size == sizeof(Size)) {
+	    Size scrsz;
+	    memcpy (&scrsz, frame_data (f), sizeof(scrsz));
+	    char n [16];
+	    snprintf (n, sizeof(n), "%u", scrsz.w);
+	    setenv ("COLUMNS", n, true);
+	    snprintf (n, sizeof(n), "%u", scrsz.h);
+	    setenv ("LINES", n, true);
+	    break;
+	}
+    }
+    auto& scr = TerminalScreen::instance();
+    scr.set_headless();
+    if (_castfile && (!make_temp_file (_tmpcast, sizeof(_tmpcast)) || !scr.record (_tmpcast))) {
+	perror ("recording output");
+	return EXIT_FAILURE;
+    }
+
+    // Each recorded window is replayed by its own ReplayWindow
+    for (auto& f : _frames) {
+	if (f.type != Recorder::Type::Open || !f.id || _nreplays >= size(_replays))
+	    continue;
+	auto i = 0u;
+	while (i < _nreplays && _replays[i].recid != f.id)
+	    ++i;
+	if (i == _nreplays)
+	    _replays[_nreplays++].recid = f.id;
+    }
+    if (!_nreplays) {
+	fprintf (stderr, "%s: no windows recorded\n", _recfile);
+	return EXIT_FAILURE;
+    }
+    // ReplayWindows take the recorded ids in the order they are created
+    _start = nsnow();
+    for (auto i = 0u; i < _nreplays; ++i)
+	_replays[i].pwin.create_dest_as<ReplayWindow>();
+    return AppL::run();
+}
+
+uint16_t ReplayApp::recorded_id (mrid_t mid) const
+{
+    for (auto i = 0u; i < _nreplays; ++i)
+	if (_replays[i].pwin.dest() == mid)
+	    return _replays[i].recid;
+    return 0;
+}
+
+// Finds the next Open or Draw frame of window recid, starting at i
+const RecordedFrame* ReplayApp::next_frame (uint16_t recid, uint32_t& i) const
+{
+    for (; i < _frames.size(); ++i)
+	if (_frames[i].id == recid && (_frames[i].type == Recorder::Type::Open || _frames[i].type == Recorder::Type::Draw))
+	    return &_frames[i++];
+    return nullptr;
+}
+
+void ReplayApp::on_msger_destroyed (mrid_t mid)
+{
+    if (recorded_id (mid) && ++_nclosed == _nreplays) {
+	auto elapsed = nsnow() - _start;
+	auto s = TerminalScreen::instance().stats();
+	printf ("Replayed %u drawlists from %u windows in %.1f ms\n", _ndrawlists, _nreplays, elapsed/1e6);
+	printf ("    %u frames, %.1f us/frame, %u bytes/frame, %u dropped\n",
+		s.frames, s.frames ? elapsed/1e3/s.frames : 0.,
+		s.recent ? s.sum.bytes/s.recent : 0u, s.sum.dropped);
+	if (_castfile) {
+	    TerminalScreen::instance().recorder().close();
+	    if (!write_asciicast (_tmpcast, _castfile))
+		perror (_castfile);
+	    unlink (_tmpcast);
+	}
+	quit();
+    }
+    AppL::on_msger_destroyed (mid);
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ ReplayWindow implementation
+
+ReplayWindow::ReplayWindow (Msg::Link l)
+: Msger (l)
+,_scr (l.dest)
+,_ptimer (l.dest)
+,_recid (ReplayApp::instance().take_recorded_id())
+,_next()
+{
+    send_next();
+}
+
+// Sends window opens up to the next drawlist, and the drawlist when due
+void ReplayWindow::send_next (void)
+{
+    auto& app = ReplayApp::instance();
+    auto i = _next;
+    for (const RecordedFrame* f; (f = app.next_frame (_recid, i)); _next = i) {
+	if (f->type == Recorder::Type::Open) {
+	    WindowInfo wi;
+	    memcpy (&wi, app.frame_data (*f), min (sizeof(wi), size_t(f->size)));
+	    _scr.open (wi);
+	    continue;
+	}
+	if (auto due = app.frame_due (*f), now = nsnow(); due > now)
+	    return _ptimer.start (ITimer::now() + (due-now)/1000000);
+	auto dl = _scr.begin_draw();
+	dl.resize (dl.size() + f->size);
+	copy_n (app.frame_data (*f), f->size, dl.end() - f->size);
+	_scr.end_draw (move (dl));
+	app.count_drawlist();
+	_next = i;
+	return;	// the next one is sent on vsync
+    }
+    close();
+}
+
+void ReplayWindow::Screen_event (const Event& ev)
+{
+    if (flag (f_Unused))
+	return;
+    if (ev.type() == Event::Type::VSync)
+	send_next();
+    else if (ev.type() == Event::Type::Close)
+	close();
+}
+
+void ReplayWindow::on_msger_destroyed (mrid_t mid)
+{
+    if (mid == _scr.dest())
+	set_unused();
+    Msger::on_msger_destroyed (mid);
+}
+
+CWICLO_APP_L (ReplayApp, (App::Timer)(TerminalScreenWindow))
+
+//}}}-------------------------------------------------------------------
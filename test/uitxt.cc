@@ -128,7 +128,12 @@ void UITWindow::on_selection (widgetid_t id, unsigned f, unsigned l)
 class TestApp : public AppL {
 public:
     static auto& instance (void) { static TestApp s_app; return s_app; }
-    int run (void) { _uitwp.create_dest_as<UITWindow>(); return AppL::run(); }
+    int run (void) {
+	// Headless, to check what is on the screen instead of the output
+	TerminalScreen::instance().set_headless();
+	_uitwp.create_dest_as<UITWindow>();
+	return AppL::run();
+    }
 private:
     TestApp (void) : AppL(),_uitwp (mrid_App) {}
 private:
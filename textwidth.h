@@ -0,0 +1,22 @@
+// This file is part of the cwiclui project
+//
+// Copyright (c) 2021 by Mike Sharov <msharov@users.sourceforge.net>
+// This file is free software, distributed under the ISC License.
+
+#pragma once
+#include "uidefs.h"
+
+namespace cwiclui {
+
+// Number of terminal columns taken by a character: 0 for combining
+// marks and other zero-width characters, 2 for East Asian wide ones
+// and emoji, and 1 for everything else. Nothing below U+0300 is wide
+// or zero-width, so the common case does not touch the table.
+unsigned char_width_lookup (char32_t c) PURE;
+inline static unsigned char_width (char32_t c)
+    { return c < 0x300 ? 1 : char_width_lookup (c); }
+
+// Width in columns of n bytes of UTF-8 text, without control chars
+unsigned text_width (const char* s, size_t n) PURE;
+
+} // namespace cwiclui
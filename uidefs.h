@@ -220,7 +220,7 @@ struct KMod {
     static constexpr const Event::key_t Alt	= Ctrl<<1;
     static constexpr const Event::key_t Banner	= Alt<<1;
     static constexpr const Event::key_t Left	= Banner<<1;
-    static constexpr const Event::key_t Middle	= Left<1;
+    static constexpr const Event::key_t Middle	= Left<<1;
     static constexpr const Event::key_t Right	= Middle<<1;
     static constexpr const Event::key_t Mask	= ~(Shift-1);
 };
@@ -448,6 +448,7 @@ class IScreen : public Interface {
 	(expose,	"")
 	(resize,	SIGNATURE_ui_WindowInfo)
 	(screen_info,	SIGNATURE_ui_ScreenInfo)
+	(clipboard,	SIGNATURE_ui_Event "s")
     )
 public:
     using drawlist_t	= memblock;
@@ -484,6 +485,8 @@ public:
 			{ send (m_resize(), wi); }
 	void	screen_info (const ScreenInfo& si) const
 			{ send (m_screen_info(), si); }
+	void	clipboard (const Event& e, const string& t) const
+			{ send (m_clipboard(), e, t); }
 	template <typename O>
 	inline static constexpr bool dispatch (O* o, const Msg& msg) {
 	    if (msg.method() == m_event())
@@ -494,7 +497,11 @@ public:
 		o->Screen_resize (msg.read().read<WindowInfo>());
 	    else if (msg.method() == m_screen_info())
 		o->Screen_screen_info (msg.read().read<ScreenInfo>());
-	    else
+	    else if (msg.method() == m_clipboard()) {
+		auto is = msg.read();
+		decltype(auto) e = is.read<Event>();
+		o->Screen_clipboard (e, is.read<string_view>());
+	    } else
 		return false;
 	    return true;
 	}
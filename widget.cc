@@ -74,7 +74,7 @@ auto Widget::measure_text (const string_view& text) -> Size
 	auto lend = text.find ('\n', l);
 	if (!lend)
 	    lend = textend;
-	sz.w = max (sz.w, lend-l);
+	sz.w = max (sz.w, dim_t (text_width (l, lend-l)));	// in columns, as drawn
 	++sz.h;
 	l = lend+1;
     }
@@ -141,6 +141,18 @@ void Widget::draw (drawlist_t& dl) const
     }
 }
 
+// Appends this widget and all shown subwidgets, in drawing order
+void Widget::get_visible_widgets (vector<Widget*>& v)
+{
+    if (!area().empty())
+	v.push_back (this);
+    for (auto i = 0u; i < _widgets.size(); ++i) {
+	if (unlikely (layinfo().type() == Type::Stack && selection_start() != i))
+	    continue;
+	_widgets[i]->get_visible_widgets (v);
+    }
+}
+
 //}}}-------------------------------------------------------------------
 //{{{ Focus
 
@@ -197,14 +209,20 @@ void Widget::on_event (const Event& ev)
     // Key events go only to the focused widget
     if (ev.type() == Event::Type::KeyDown || ev.type() == Event::Type::KeyUp) {
 	// on_key handlers are called in leaves and in focusable containers
-	if (flag (f_CanFocus))	// only call if the widget is able to handle it
-	    on_key (ev.key());
+	if (flag (f_CanFocus)) {	// only call if the widget is able to handle it
+	    if (ev.mods() > 1)	// runs of the same key are merged, with the count in mods
+		on_repeated_key (ev.key(), ev.mods());
+	    else
+		on_key (ev.key());
+	}
 	// Key events that the focused widget does not use are forwarded
 	// back here with the source widget id set to that widget.
 	auto focusw = find_if (_widgets, [](auto& w) { return w->focused(); });
 	if (focusw)
 	    (*focusw)->on_event (ev);
-    } else for (auto& w : _widgets)
+    } else if (ev.type() == Event::Type::ButtonDown || ev.type() == Event::Type::ButtonUp || ev.type() == Event::Type::Motion)
+	on_pointer (ev);	// sent by the window only to the widget under the pointer
+    else for (auto& w : _widgets)
 	w->on_event (ev);
 }
 
@@ -131,6 +131,7 @@ public:
     void		set_area (const Point& p)		{ _area.move_to (p); }
     void		set_area (const Size& sz)		{ _area.resize (sz); }
     void		draw (drawlist_t& dl) const;
+    void		get_visible_widgets (vector<Widget*>& v);
     auto		flag (unsigned f) const			{ return get_bit(_flags,f); }
     void		set_flag (unsigned f, bool v = true)	{ set_bit(_flags,f,v); }
     bool		is_modified (void) const		{ return flag (f_Modified); }
@@ -146,6 +147,9 @@ public:
     virtual void	on_resize (void);
     virtual void	on_event (const Event& ev);
     virtual void	on_key (key_t);
+    virtual void	on_repeated_key (key_t k, unsigned n)	{ for (; n; --n) on_key (k); }
+    virtual void	on_paste (const string_view&)		{ }
+    virtual void	on_pointer (const Event&)		{ }
     static Size		measure_text (const string_view& text);
     auto		measure (void) const			{ return measure_text (text()); }
     auto		focused (void) const			{ return flag (f_Focused); }
@@ -14,6 +14,7 @@ IMPLEMENT_INTERFACES_D (Window)
 Window::Window (Msg::Link l)
 : Msger (l)
 ,_widgets()
+,_hits()
 ,_widgets_area()
 ,_scr (l.dest)
 ,_size_hints()
@@ -44,6 +45,15 @@ void Window::create_widgets (const Widget::Layout* f, const Widget::Layout* l)
     _widgets = Widget::create (this, *f);
     f = _widgets->add_widgets (next(f), l);
     assert (f == l && "Your layout array must have a single root widget containing all the others");
+    // The index points to the widgets, so must not outlive them
+    build_hit_index();
+}
+
+Widget* Window::replace_widget (unique_ptr<Widget>&& w)
+{
+    auto r = _widgets->replace_widget (move(w));
+    build_hit_index();
+    return r;
 }
 
 //}}}-------------------------------------------------------------------
@@ -78,6 +88,7 @@ void Window::set_stack_selection (widgetid_t id, dim_t s)
 	w->set_stack_selection (s);
 	if (w->focused())
 	    focus_next();
+	build_hit_index();	// the newly shown page has different widgets
     }
 }
 
@@ -120,6 +131,7 @@ void Window::Screen_resize (const Info& wi)
 	if (!focused_widget_id())
 	    focus_next();
     }
+    build_hit_index();
     draw();
 }
 
@@ -149,10 +161,18 @@ void Window::on_event (const Event& ev)
 {
     // KeyDown events go only to the focused widget
     if (ev.type() == Event::Type::KeyDown && (focused_widget_id() == wid_None || ev.src() != wid_None))
-	on_key (ev.key());	// key events unused by widgets are processed in the window handler
+	for (auto n = max (ev.mods(), uint8_t(1)); n; --n)
+	    on_key (ev.key());	// key events unused by widgets are processed in the window handler
     else if (ev.type() == Event::Type::Close)
 	close();
-    else if (ev.type() == Event::Type::VSync) {
+    else if (ev.type() == Event::Type::ButtonDown || ev.type() == Event::Type::ButtonUp || ev.type() == Event::Type::Motion) {
+	// Pointer events go only to the widget under the pointer
+	if (auto w = _hits.find (ev.loc()); w) {
+	    if (ev.type() == Event::Type::ButtonDown && w->widget_id() != focused_widget_id())
+		focus_widget (w->widget_id());
+	    w->on_event (ev);
+	}
+    } else if (ev.type() == Event::Type::VSync) {
 	set_flag (f_DrawInProgress, false);
 	if (flag (f_DrawPending))
 	    draw();
@@ -160,6 +180,60 @@ void Window::on_event (const Event& ev)
 	_widgets->on_event (ev);
 }
 
+// Pasted text goes to the focused widget
+void Window::on_clipboard (const Event& ev, const string_view& t)
+{
+    if (ev.key() == Event::key_t(ClipboardOp::Read))
+	if (auto w = focused_widget(); w)
+	    w->on_paste (t);
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ HitIndex
+
+void Window::HitIndex::build (Widget* root, const Size& wsz)
+{
+    vector<Widget*> visible;
+    if (root)
+	root->get_visible_widgets (visible);
+    _gsz = Size ((wsz.w+CellW-1)/CellW, (wsz.h+CellH-1)/CellH);
+    // Count widgets in each cell, then place each in the lists of its cells
+    _first.resize (_gsz.w*_gsz.h+1);
+    fill (_first, 0);
+    auto foreach_cell = [&](const Widget* w, auto f) {
+	auto& a = w->area();
+	auto gx = max (a.x, coord_t(0))/CellW, gy = max (a.y, coord_t(0))/CellH;
+	auto gxe = min (unsigned(a.x+a.w+CellW-1)/CellW, unsigned(_gsz.w));
+	auto gye = min (unsigned(a.y+a.h+CellH-1)/CellH, unsigned(_gsz.h));
+	for (auto y = unsigned(gy); y < gye; ++y)
+	    for (auto x = unsigned(gx); x < gxe; ++x)
+		f (y*_gsz.w+x);
+    };
+    for (auto w : visible)
+	foreach_cell (w, [&](unsigned c) { ++_first[c+1]; });
+    for (auto c = 1u; c < _first.size(); ++c)
+	_first[c] += _first[c-1];
+    _widgets.resize (_first.back());
+    vector<uint32_t> fillpos (_first);
+    for (auto w : visible)	// in drawing order, so widgets on top are last
+	foreach_cell (w, [&](unsigned c) { _widgets[fillpos[c]++] = w; });
+}
+
+Widget* Window::HitIndex::find (const Point& p) const
+{
+    unsigned gx = p.x/CellW, gy = p.y/CellH;
+    if (p.x < 0 || p.y < 0 || gx >= _gsz.w || gy >= _gsz.h)
+	return nullptr;
+    auto c = gy*_gsz.w+gx;
+    for (auto i = _first[c+1]; i > _first[c]; --i)
+	if (_widgets[i-1]->area().contains (p))
+	    return _widgets[i-1];
+    return nullptr;
+}
+
+//}}}-------------------------------------------------------------------
+//{{{ Key handling
+
 void Window::on_key (key_t k)
 {
     if (k == Key::Tab)
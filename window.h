@@ -19,6 +19,24 @@ public:
     using drawlist_t	= IScreen::drawlist_t;
     using windowid_t	= WindowInfo::windowid_t;
     enum { f_DrawInProgress = Msger::f_Last, f_DrawPending, f_Last };
+    //{{{ HitIndex
+    // Uniform grid over the window, listing in each cell the widgets
+    // overlapping it, to find the widget under the pointer without
+    // walking the widget tree.
+    class HitIndex {
+    public:
+	enum { CellW = 8, CellH = 4 };
+    public:
+			HitIndex (void)		:_gsz(),_first(),_widgets() {}
+	void		build (Widget* root, const Size& wsz);
+	void		clear (void)		{ _gsz = Size(); _first.clear(); _widgets.clear(); }
+	Widget*		find (const Point& p) const;
+    private:
+	Size		_gsz;		// Grid size in cells
+	vector<uint32_t> _first;	// Index in _widgets of each cell's list, plus the end
+	vector<Widget*>	_widgets;
+    };
+    //}}}
 public:
     explicit		Window (Msg::Link l);
     void		draw (void);
@@ -26,6 +44,7 @@ public:
     virtual void	on_modified (widgetid_t, const string_view&) { draw(); }
     virtual void	on_selection (widgetid_t, unsigned, unsigned) { draw(); }
     virtual void	on_key (key_t key);
+    virtual void	on_clipboard (const Event& ev, const string_view& t);
     void		close (void);
 
     void		Widget_event (const Event& ev)	{ on_event (ev); }
@@ -38,6 +57,8 @@ public:
     void		Screen_resize (const Info& wi);
     void		Screen_screen_info (const ScreenInfo& scrinfo)
 			    { _scrinfo = scrinfo; layout(); }
+    void		Screen_clipboard (const Event& ev, const string_view& t)
+			    { on_clipboard (ev, t); }
 
     auto		window_id (void) const		{ return _scr.dest(); }
     auto&		window_info (void)		{ return _info; }
@@ -55,8 +76,8 @@ protected:
     template <unsigned N>
     void		create_widgets (const Layout (&l)[N])
 			    { create_widgets (begin(l), end(l)); }
-    auto		replace_widget (unique_ptr<Widget>&& w)	{ return _widgets->replace_widget (move(w)); }
-    void		destroy_widgets (void)			{ _widgets.reset(); }
+    Widget*		replace_widget (unique_ptr<Widget>&& w);
+    void		destroy_widgets (void)			{ _hits.clear(); _widgets.reset(); }
     auto		widget_by_id (widgetid_t id) const	{ return _widgets->widget_by_id(id); }
     auto		widget_by_id (widgetid_t id)		{ return _widgets->widget_by_id(id); }
     void		set_widgets_area (const Rect& wa)	{ _widgets_area = wa; }
@@ -86,8 +107,10 @@ protected:
     void		focus_prev (void);
 private:
     virtual void	on_draw (drawlist_t&) const {}
+    void		build_hit_index (void)		{ _hits.build (_widgets.get(), area().size()); }
 private:
     unique_ptr<Widget>	_widgets;
+    HitIndex		_hits;
     Rect		_widgets_area;
     IScreen		_scr;
     Size		_size_hints;